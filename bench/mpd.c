@@ -0,0 +1,151 @@
+#include "util.h"
+
+#include <mpd/client.h>
+#include <mpd/song.h>
+#include <mpd/status.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct phase {
+	const char *name;
+	bool (*run)(struct mpd_connection *conn);
+	uint64_t *trip_us;
+	int trips;
+};
+
+static bool run_separate(struct mpd_connection *conn);
+static bool run_list(struct mpd_connection *conn);
+static int cmp_u64(const void *a, const void *b);
+static void measure(struct mpd_connection *conn,
+	struct phase *phase, int count);
+static void report(struct phase *phase);
+
+static struct phase phases[] = {
+	{ .name = "separate", .run = run_separate },
+	{ .name = "list", .run = run_list },
+};
+
+bool
+run_separate(struct mpd_connection *conn)
+{
+	struct mpd_status *status;
+	struct mpd_song *song;
+
+	/* one round trip per command */
+	status = mpd_run_status(conn);
+	if (!status) return false;
+	mpd_status_free(status);
+
+	song = mpd_run_current_song(conn);
+	if (song) mpd_song_free(song);
+
+	return mpd_connection_get_error(conn) == MPD_ERROR_SUCCESS;
+}
+
+bool
+run_list(struct mpd_connection *conn)
+{
+	struct mpd_status *status;
+	struct mpd_song *song;
+
+	/* the same commands in one round trip, as in mpd_refresh */
+	if (!mpd_command_list_begin(conn, true)
+			|| !mpd_send_status(conn)
+			|| !mpd_send_current_song(conn)
+			|| !mpd_command_list_end(conn))
+		return false;
+
+	status = mpd_recv_status(conn);
+	if (!status) return false;
+	mpd_status_free(status);
+
+	if (mpd_response_next(conn)) {
+		song = mpd_recv_song(conn);
+		if (song) mpd_song_free(song);
+	}
+
+	return mpd_response_finish(conn);
+}
+
+int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = *(const uint64_t *) a;
+	y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+void
+measure(struct mpd_connection *conn, struct phase *phase, int count)
+{
+	uint64_t start;
+	int i;
+
+	phase->trip_us = malloc(count * sizeof(uint64_t));
+	if (!phase->trip_us) ERROR(SYSTEM, "malloc");
+
+	phase->trips = 0;
+	for (i = 0; i < count; i++) {
+		start = current_us();
+		if (!phase->run(conn))
+			ERRORX(SYSTEM, "MPD ERR - %s",
+				mpd_connection_get_error_message(conn));
+		phase->trip_us[phase->trips++] = current_us() - start;
+	}
+}
+
+void
+report(struct phase *phase)
+{
+	uint64_t *us;
+	int n;
+
+	n = phase->trips;
+	if (!n) return;
+
+	us = phase->trip_us;
+	qsort(us, n, sizeof(uint64_t), cmp_u64);
+
+	printf("%-12s %6i refreshes  p50 %6lu us  p90 %6lu us"
+		"  p99 %6lu us  max %6lu us\n",
+		phase->name, n, us[n / 2], us[n * 9 / 10],
+		us[n * 99 / 100], us[n - 1]);
+
+	free(phase->trip_us);
+}
+
+int
+main(int argc, const char **argv)
+{
+	struct mpd_connection *conn;
+	int count;
+	size_t i;
+
+	count = argc > 1 ? atoi(argv[1]) : 1000;
+
+	/* needs a server, MPD_HOST and MPD_PORT pick it */
+	if (!getenv("MPD_HOST")) {
+		printf("MPD_HOST not set, skipped\n");
+		return 0;
+	}
+
+	conn = mpd_connection_new(NULL, 0, 0);
+	if (!conn) ERROR(SYSTEM, "mpd_connection_new");
+	if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
+		ERRORX(SYSTEM, "MPD ERR - %s",
+			mpd_connection_get_error_message(conn));
+
+	for (i = 0; i < ARRLEN(phases); i++)
+		measure(conn, &phases[i], count);
+
+	for (i = 0; i < ARRLEN(phases); i++)
+		report(&phases[i]);
+
+	mpd_connection_free(conn);
+
+	return 0;
+}
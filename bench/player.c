@@ -0,0 +1,96 @@
+#include "data.h"
+#include "player.h"
+#include "list.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void setup(int count);
+static void check(void);
+
+void
+setup(int count)
+{
+	struct tag *tag;
+	char name[32];
+	int i;
+
+	list_init(&tracks);
+	olist_init(&tags);
+	list_init(&tags_sel);
+
+	datadir = "bench";
+
+	tag = tag_add("bench");
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "track%06i.mp3", i);
+		track_add(tag, name);
+	}
+
+	list_push_back(&tags_sel, &tag->link_sel);
+	playlist_outdated = true;
+}
+
+void
+check(void)
+{
+	ASSERT(player.loaded);
+	ASSERT(player.track != NULL);
+	ASSERT(onode_inuse(&player.track->link_pl));
+}
+
+int
+main(int argc, const char **argv)
+{
+	struct link *link;
+	unsigned long target, steps;
+	uint64_t start, dur;
+	int count;
+
+	count = argc > 1 ? atoi(argv[1]) : 100;
+	target = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+
+	setenv("TMUS_PLAYER", "sim", 1);
+	setenv("TMUS_SIM_SPEED", "0", 1);
+
+	setup(count);
+	player_init();
+	playlist_update();
+	player.shuffle = getenv("BENCH_SEQUENTIAL") == NULL;
+
+	start = current_ms();
+
+	player_next();
+	for (steps = 0; player_sim_transitions() < target; steps++) {
+		/* mix in queue and history navigation */
+		if (steps % 97 == 0) {
+			link = olist_at(&player.playlist, steps % count);
+			player_queue_push(UPCAST(link,
+				struct track, link_pl.link));
+		}
+		if (steps % 101 == 0) {
+			player_prev();
+			player_next();
+		}
+
+		player_sim_advance(60 * 1000);
+
+		/* sequential playback stops at the end of the playlist */
+		if (!player.loaded && !player.shuffle)
+			player_next();
+
+		check();
+	}
+
+	dur = MAX(1, current_ms() - start);
+
+	printf("%i tracks, %lu transitions in %lu ms (%lu/s)\n",
+		count, player_sim_transitions(), dur,
+		player_sim_transitions() * 1000 / dur);
+
+	player_deinit();
+	data_free();
+
+	return 0;
+}
@@ -0,0 +1,250 @@
+#define NCURSES_WIDECHAR 1
+
+#include "data.h"
+#include "player.h"
+#include "termcount.h"
+#include "tui.h"
+#include "list.h"
+#include "util.h"
+
+#include <ncurses.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_ENTER_ '\n'
+#define KEY_TAB_ '\t'
+
+struct phase {
+	const char *name;
+	uint64_t *frame_us;
+	int frames, cap;
+	uint64_t bytes;
+};
+
+static void setup(int count);
+static int cmp_u64(const void *a, const void *b);
+static void keys(const wint_t *seq, int len);
+static void keystr(const char *str);
+static void frame(struct phase *phase);
+static void report(struct phase *phase);
+
+static struct phase phases[] = {
+	{ .name = "idle" },
+	{ .name = "tag scroll" },
+	{ .name = "tag toggle" },
+	{ .name = "track scroll" },
+	{ .name = "track page" },
+	{ .name = "search" },
+	{ .name = "playlist" },
+};
+
+void
+setup(int count)
+{
+	struct tag *tag, *all;
+	char name[32];
+	int i, per_tag;
+
+	list_init(&tracks);
+	olist_init(&tags);
+	list_init(&tags_sel);
+
+	datadir = "bench";
+
+	/* half in one large tag, the rest spread over small ones */
+	all = tag = tag_add("all");
+	for (i = 0; i < count / 2; i++) {
+		snprintf(name, sizeof(name), "track%07i.mp3", i);
+		track_add(tag, name);
+	}
+
+	per_tag = 1000;
+	for (; i < count; i++) {
+		if ((i - count / 2) % per_tag == 0) {
+			snprintf(name, sizeof(name), "tag%05i", i / per_tag);
+			tag = tag_add(name);
+		}
+		snprintf(name, sizeof(name), "track%07i.mp3", i);
+		track_add(tag, name);
+	}
+
+	list_push_back(&tags_sel, &all->link_sel);
+	playlist_outdated = true;
+}
+
+int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = *(const uint64_t *) a;
+	y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+void
+keys(const wint_t *seq, int len)
+{
+	int i;
+
+	/* pushed back input is read last in first out,
+	 * key codes only come back as such through ungetch */
+	for (i = len - 1; i >= 0; i--) {
+		if (seq[i] >= KEY_MIN)
+			ungetch(seq[i]);
+		else
+			unget_wch(seq[i]);
+	}
+}
+
+void
+keystr(const char *str)
+{
+	wint_t seq[64];
+	int i;
+
+	for (i = 0; str[i] && i < ARRLEN(seq); i++)
+		seq[i] = (unsigned char) str[i];
+	keys(seq, i);
+}
+
+void
+frame(struct phase *phase)
+{
+	uint64_t start, bytes;
+
+	bytes = termcount_bytes();
+	start = current_us();
+
+	player_update();
+	if (!tui_update())
+		ERRORX(USER, "tui quit during benchmark");
+
+	if (phase->frames == phase->cap) {
+		phase->cap = MAX(64, phase->cap * 2);
+		phase->frame_us = realloc(phase->frame_us,
+			phase->cap * sizeof(uint64_t));
+		if (!phase->frame_us) ERROR(SYSTEM, "realloc");
+	}
+	phase->frame_us[phase->frames++] = current_us() - start;
+	phase->bytes += termcount_bytes() - bytes;
+}
+
+void
+report(struct phase *phase)
+{
+	uint64_t *us;
+	int n;
+
+	n = phase->frames;
+	if (!n) return;
+
+	us = phase->frame_us;
+	qsort(us, n, sizeof(uint64_t), cmp_u64);
+
+	/* stdout is /dev/null */
+	fprintf(stderr, "%-12s %6i frames  p50 %6lu us  p90 %6lu us"
+		"  p99 %6lu us  max %6lu us  %8lu bytes (%lu/frame)\n",
+		phase->name, n, us[n / 2], us[n * 9 / 10], us[n * 99 / 100],
+		us[n - 1], phase->bytes, phase->bytes / n);
+
+	free(phase->frame_us);
+}
+
+int
+main(int argc, const char **argv)
+{
+	static const wint_t down[] = { KEY_DOWN };
+	static const wint_t npage[] = { KEY_NPAGE };
+	static const wint_t toggle[] = { KEY_DOWN, ' ' };
+	static const wint_t tab[] = { KEY_TAB_ };
+	static const wint_t enter[] = { KEY_ENTER_ };
+	static const wint_t last[] = { 'G' };
+	static const wint_t first[] = { 'g' };
+	static const wint_t playlist[] = { 'P' };
+	char query[64];
+	int count, rounds, i;
+
+	count = argc > 1 ? atoi(argv[1]) : 10000;
+	rounds = argc > 2 ? atoi(argv[2]) : 200;
+
+	setenv("TMUS_PLAYER", "sim", 1);
+	setenv("TMUS_SIM_SPEED", "0", 1);
+	setenv("TMUS_MAX_FPS", "0", 1);
+	setenv("TMUS_TERM_STATS", "1", 1);
+	setenv("LINES", "50", 0);
+	setenv("COLUMNS", "160", 0);
+
+	/* curses output is counted, then discarded */
+	if (!freopen("/dev/null", "w", stdout)
+			|| !freopen("/dev/null", "r", stdin))
+		ERROR(SYSTEM, "freopen");
+
+	setup(count);
+	player_init();
+	tui_init();
+
+	/* first frame draws everything */
+	frame(&phases[0]);
+	for (i = 0; i < rounds; i++)
+		frame(&phases[0]);
+
+	for (i = 0; i < rounds; i++) {
+		keys(down, ARRLEN(down));
+		frame(&phases[1]);
+	}
+
+	for (i = 0; i < rounds / 4; i++) {
+		keys(toggle, ARRLEN(toggle));
+		frame(&phases[2]);
+	}
+
+	/* back to the large tag */
+	keys(first, ARRLEN(first));
+	frame(&phases[2]);
+	keys(enter, ARRLEN(enter));
+	frame(&phases[2]);
+	keys(tab, ARRLEN(tab));
+	frame(&phases[3]);
+
+	for (i = 0; i < rounds; i++) {
+		keys(down, ARRLEN(down));
+		frame(&phases[3]);
+	}
+
+	for (i = 0; i < rounds; i++) {
+		keys(i % 8 ? npage : (i % 16 ? last : first), 1);
+		frame(&phases[4]);
+	}
+
+	for (i = 0; i < rounds / 10; i++) {
+		snprintf(query, sizeof(query), "~track%07i.mp3\n",
+			rand() % MAX(1, count / 2));
+		keystr(query);
+		frame(&phases[5]);
+	}
+
+	keys(playlist, ARRLEN(playlist));
+	frame(&phases[6]);
+	for (i = 0; i < rounds; i++) {
+		keys(i % 8 ? down : npage, 1);
+		frame(&phases[6]);
+	}
+	keys(playlist, ARRLEN(playlist));
+	frame(&phases[6]);
+
+	tui_deinit();
+
+	fprintf(stderr, "%i tracks, %ix%i terminal\n",
+		count, atoi(getenv("COLUMNS")), atoi(getenv("LINES")));
+	for (i = 0; i < ARRLEN(phases); i++)
+		report(&phases[i]);
+
+	player_deinit();
+	data_free();
+
+	return 0;
+}
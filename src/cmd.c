@@ -1,6 +1,8 @@
 #include "cmd.h"
 
 #include "data.h"
+#include "dedup.h"
+#include "job.h"
 #include "list.h"
 #include "player.h"
 #include "ref.h"
@@ -16,6 +18,9 @@ static const struct cmd *last_cmd;
 static char *last_args;
 
 static void cmd_status_from_errno(int err);
+static bool cmd_track_job(int type, const char *name);
+static bool cmd_tag_dup(struct track *track, unsigned int batch);
+static bool cmd_rename_marked(const char *args);
 
 static bool cmd_save(const char *args);
 static bool cmd_move(const char *args);
@@ -24,6 +29,10 @@ static bool cmd_reindex(const char *args);
 static bool cmd_add_tag(const char *args);
 static bool cmd_rm_tag(const char *args);
 static bool cmd_rename(const char *args);
+static bool cmd_backend(const char *args);
+static bool cmd_cancel(const char *args);
+static bool cmd_dedup(const char *args);
+static bool cmd_tag(const char *args);
 
 const struct cmd commands[] = {
 	{ "save", cmd_save },
@@ -33,6 +42,10 @@ const struct cmd commands[] = {
 	{ "addtag", cmd_add_tag },
 	{ "rmtag", cmd_rm_tag },
 	{ "rename", cmd_rename },
+	{ "backend", cmd_backend },
+	{ "cancel", cmd_cancel },
+	{ "dedup", cmd_dedup },
+	{ "tag", cmd_tag },
 };
 
 const size_t command_count = ARRLEN(commands);
@@ -54,8 +67,8 @@ cmd_save(const char *args)
 	struct link *link;
 	struct tag *tag;
 
-	for (LIST_ITER(&tags, link)) {
-		tag = UPCAST(link, struct tag, link);
+	for (LIST_ITER(&tags.list, link)) {
+		tag = UPCAST(link, struct tag, link.link);
 		if (tag->index_dirty || tag->reordered)
 			tag_save_tracks(tag);
 	}
@@ -64,11 +77,13 @@ cmd_save(const char *args)
 }
 
 bool
-cmd_move(const char *name)
+cmd_track_job(int type, const char *name)
 {
+	struct list targets;
 	struct link *link;
 	struct track *track;
 	struct tag *tag;
+	struct job *job;
 
 	tag = tag_find(name);
 	if (!tag) {
@@ -76,20 +91,23 @@ cmd_move(const char *name)
 		return false;
 	}
 
-	link = list_at(tracks_vis, track_nav.sel);
-	if (!link) {
+	list_init(&targets);
+	if (!tui_take_tracks(&targets)) {
 		USER_STATUS("No track selected");
 		return false;
 	}
-	track = tracks_vis_track(link);
 
-	if (track->tag == tag) {
-		USER_STATUS("Same tag");
-		return false;
+	/* one job for all, applied together when done */
+	job = job_create(type, tag);
+	for (LIST_ITER(&targets, link)) {
+		track = UPCAST(link, struct ref, link)->data;
+		if (track->tag != tag)
+			job_add_track(job, track);
 	}
+	refs_free(&targets);
 
-	if (!track_move(track, tag)) {
-		cmd_status_from_errno(errno);
+	if (!job_submit(job)) {
+		USER_STATUS("Same tag");
 		return false;
 	}
 
@@ -97,87 +115,46 @@ cmd_move(const char *name)
 }
 
 bool
-cmd_copy(const char *name)
+cmd_move(const char *name)
 {
-	struct link *link;
-	struct track *track, *new;
-	struct tag *tag;
-	char *newpath;
-
-	tag = tag_find(name);
-	if (!tag) {
-		USER_STATUS("Tag not found");
-		return false;
-	}
-
-	link = list_at(tracks_vis, track_nav.sel);
-	if (!link) {
-		USER_STATUS("No track selected");
-		return false;
-	}
-	track = tracks_vis_track(link);
-
-	if (track->tag == tag) {
-		USER_STATUS("Same tag");
-		return false;
-	}
-
-	newpath = aprintf("%s/%s", tag->fpath, track->name);
-	if (path_exists(newpath)) {
-		free(newpath);
-		USER_STATUS("File already exists");
-		return false;
-	}
-
-	if (!dup_file(track->fpath, newpath)) {
-		free(newpath);
-		USER_STATUS("Failed to copy track");
-		return false;
-	}
-	free(newpath);
-
-	new = track_add(tag, track->name);
-	if (!new) {
-		rm_file(track->fpath);
-		USER_STATUS("Failed to copy track");
-		return false;
-	}
+	return cmd_track_job(JOB_MOVE, name);
+}
 
-	return true;
+bool
+cmd_copy(const char *name)
+{
+	return cmd_track_job(JOB_COPY, name);
 }
 
 bool
 cmd_reindex(const char *name)
 {
-	struct track *track;
 	struct link *link;
 	struct tag *tag;
 	struct ref *ref;
 	struct list matches;
-	struct tag *playing_tag;
-	char *playing_name;
+	uint64_t playing_id;
 	bool status;
 
 	status = false;
-	playing_tag = NULL;
-	playing_name = NULL;
+	playing_id = 0;
 	list_init(&matches);
 
 	if (!*name) {
-		link = list_at(&tags, tag_nav.sel);
+		link = olist_at(&tags, tag_nav.sel);
 		if (!link) return false;
-		tag = UPCAST(link, struct tag, link);
+		tag = UPCAST(link, struct tag, link.link);
 		ref = ref_alloc(tag);
 		list_push_back(&matches, &ref->link);
 	} else if (!strcmp(name, "*")) {
-		for (LIST_ITER(&tags, link)) {
-			tag = UPCAST(link, struct tag, link);
+		for (LIST_ITER(&tags.list, link)) {
+			tag = UPCAST(link, struct tag, link.link);
 			ref = ref_alloc(tag);
 			list_push_back(&matches, &ref->link);
 		}
 	} else {
-		for (LIST_ITER(&tags, link)) {
-			tag = UPCAST(link, struct tag, link);
+		for (LIST_ITER(&tags.list, link)) {
+			tag = UPCAST(link, struct tag, link.link);
 			if (!strcmp(tag->name, name)) {
 				ref = ref_alloc(tag);
 				list_push_back(&matches, &ref->link);
@@ -189,10 +166,9 @@ cmd_reindex(const char *name)
 	if (list_empty(&matches))
 		return false;
 
-	/* save old playing track */
+	/* reindexed tracks keep their ids */
 	if (player.track) {
-		playing_tag = player.track->tag;
-		playing_name = astrdup(player.track->name);
+		playing_id = player.track->id;
 		player.track = NULL;
 	}
 
@@ -203,22 +179,14 @@ cmd_reindex(const char *name)
 			goto cleanup;
 	}
 
-	/* try to find old playing track among reindexed tracks */
-	if (playing_tag) {
-		for (LIST_ITER(&playing_tag->tracks, link)) {
-			track = UPCAST(link, struct track, link_tt);
-			if (!strcmp(track->name, playing_name)) {
-				player.track = track;
-				break;
-			}
-		}
-	}
+	/* find old playing track among reindexed tracks */
+	if (playing_id)
+		player.track = track_find_id(playing_id);
 
 	status = true;
 
 cleanup:
 	refs_free(&matches);
-	free(playing_name);
 
 	return status;
 }
@@ -250,9 +218,9 @@ cmd_rm_tag(const char *name)
 	struct tag *tag;
 
 	if (!*name) {
-		link = list_at(&tags, tag_nav.sel);
+		link = olist_at(&tags, tag_nav.sel);
 		if (!link) return false;
-		tag = UPCAST(link, struct tag, link);
+		tag = UPCAST(link, struct tag, link.link);
 	} else  {
 		tag = tag_find(name);
 		if (!tag) {
@@ -261,12 +229,56 @@ cmd_rm_tag(const char *name)
 		}
 	}
 
-	if (!tag_rm(tag, true)) {
-		USER_STATUS("Failed to remove tag");
+	job_rm_tag(tag);
+
+	return true;
+}
+
+bool
+cmd_rename_marked(const char *args)
+{
+	struct list targets;
+	struct link *link;
+	struct track *track;
+	const char *sep, *pos;
+	char *from, *name;
+	int renamed, failed;
+
+	/* track names never contain a slash */
+	sep = strchr(args, '/');
+	if (!sep) {
+		USER_STATUS("Rename marked tracks with old/new");
 		return false;
 	}
+	from = aprintf("%.*s", (int) (sep - args), args);
+
+	list_init(&targets);
+	tui_take_tracks(&targets);
+
+	renamed = failed = 0;
+	for (LIST_ITER(&targets, link)) {
+		track = UPCAST(link, struct ref, link)->data;
+		pos = strstr(track->name, from);
+		if (!pos) continue;
+
+		name = aprintf("%.*s%s%s", (int) (pos - track->name),
+			track->name, sep + 1, pos + strlen(from));
+		if (track_rename(track, name))
+			renamed += 1;
+		else
+			failed += 1;
+		free(name);
+	}
 
-	return true;
+	refs_free(&targets);
+	free(from);
+
+	if (failed)
+		USER_STATUS("Renamed %i tracks, %i failed", renamed, failed);
+	else
+		USER_STATUS("Renamed %i tracks", renamed);
+
+	return !failed;
 }
 
 bool
@@ -283,16 +295,18 @@ cmd_rename(const char *name)
 
 	ASSERT(pane_sel == cmd_pane);
 
-	if (pane_after_cmd == track_pane) {
-		link = list_at(tracks_vis, track_nav.sel);
+	if (pane_after_cmd == track_pane && !list_empty(&tracks_marked)) {
+		return cmd_rename_marked(name);
+	} else if (pane_after_cmd == track_pane) {
+		link = olist_at(tracks_vis, track_nav.sel);
 		if (!link) return false;
 		track = tracks_vis_track(link);
 		if (!track_rename(track, name))
 			return false;
 	} else if (pane_after_cmd == tag_pane) {
-		link = list_at(&tags, tag_nav.sel);
+		link = olist_at(&tags, tag_nav.sel);
 		if (!link) return false;
-		tag = UPCAST(link, struct tag, link);
+		tag = UPCAST(link, struct tag, link.link);
 		if (!tag_rename(tag, name))
 			return false;
 	}
@@ -300,6 +314,125 @@ cmd_rename(const char *name)
 	return true;
 }
 
+bool
+cmd_backend(const char *name)
+{
+	int i;
+
+	if (!*name) {
+		free(user_status);
+		user_status = astrdup("Backends:");
+		for (i = 0; i < player_backend_count; i++) {
+			user_status = appendstrf(user_status, " %s%s",
+				player_backends[i]->name,
+				player_backends[i] == player.backend ? "*" : "");
+		}
+		user_status_uptime = 10;
+		return true;
+	}
+
+	return player_set_backend(name) == PLAYER_OK;
+}
+
+bool
+cmd_cancel(const char *args)
+{
+	USER_STATUS("Canceled %i jobs", job_cancel());
+
+	return true;
+}
+
+bool
+cmd_dedup(const char *args)
+{
+	if (*args && strcmp(args, "link")) {
+		USER_STATUS("Usage: dedup [link]");
+		return false;
+	}
+
+	return dedup_start(!strcmp(args, "link"));
+}
+
+bool
+cmd_tag_dup(struct track *track, unsigned int batch)
+{
+	struct track *it;
+
+	/* one item per file, an earlier target may name it too */
+	for (it = track->ino_next; it != track; it = it->ino_next) {
+		if (it->batch == batch)
+			return true;
+	}
+	track->batch = batch;
+
+	return false;
+}
+
+bool
+cmd_tag(const char *name)
+{
+	static unsigned int batch = 0;
+	struct list targets;
+	struct link *link, *next;
+	struct track *track, *copy;
+	struct tag *tag;
+	struct job *job;
+	bool untag;
+	int count;
+
+	tag = tag_find(name);
+	if (!tag) {
+		USER_STATUS("Tag not found");
+		return false;
+	}
+
+	list_init(&targets);
+	if (!tui_take_tracks(&targets)) {
+		USER_STATUS("No track selected");
+		return false;
+	}
+
+	/* tracks of the tag itself are not targets */
+	untag = true;
+	for (link = targets.head.next; LIST_INNER(link); link = next) {
+		next = link->next;
+		track = UPCAST(link, struct ref, link)->data;
+		if (track->tag == tag) {
+			link_pop(link);
+			ref_free(UPCAST(link, struct ref, link));
+		} else if (!track_in_tag(track, tag)) {
+			untag = false;
+		}
+	}
+
+	if (list_empty(&targets)) {
+		USER_STATUS("Same tag");
+		return false;
+	}
+
+	/* add to all unless every file is in the tag already,
+	 * links are made and removed by the job workers */
+	job = untag ? job_create(JOB_DELETE, NULL) : job_create(JOB_COPY, tag);
+	if (!++batch)
+		batch = 1;
+	for (LIST_ITER(&targets, link)) {
+		track = UPCAST(link, struct ref, link)->data;
+		if (cmd_tag_dup(track, batch))
+			continue;
+		copy = track_in_tag(track, tag);
+		if (untag && copy)
+			job_add_track(job, copy);
+		else if (!untag && !copy)
+			job_add_track(job, track);
+	}
+	refs_free(&targets);
+
+	count = job_submit(job);
+	USER_STATUS("%s %i tracks", untag ? "Untagging" : "Tagging", count);
+
+	return count > 0;
+}
+
 void
 cmd_init(void)
 {
@@ -1,5 +1,10 @@
+#define _GNU_SOURCE
+
 #include "data.h"
 
+#include "job.h"
+#include "journal.h"
+#include "meta.h"
 #include "tui.h"
 #include "player.h"
 #include "list.h"
@@ -9,21 +14,64 @@
 #include <fts.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
 
+/* upper bound for a single in-kernel copy call,
+ * also how often progress and cancellation are checked */
+#define COPY_CHUNK (16UL << 20)
+
+/* buffer for copies the kernel cannot do itself */
+#define COPY_BUFSIZE (1UL << 20)
+
+/* smallest track id table, a power of two */
+#define TRACK_IDS_MIN 1024
+
+/* smallest inode table, a power of two */
+#define TRACK_INODES_MIN 1024
+
+/* ids from the .ids file of a tag, or inodes of its
+ * directory entries, looked up by name */
+struct id_entry {
+	uint64_t id;
+	char *name;
+};
+
+struct id_list {
+	struct id_entry *entries;
+	size_t count, cap, cursor;
+	size_t *slots, slots_cap; /* entry + 1 by name hash */
+	bool indexed;
+};
+
 const char *datadir;
 
 struct list tracks; /* struct track (link) */
-struct list tags; /* struct track (link) */
+struct olist tags; /* struct tag (link) */
 struct list tags_sel; /* struct tag (link_sel) */
 
 struct tag *trash_tag;
 
 bool playlist_outdated;
 
+/* open addressed id -> track table, linear probing */
+static struct track **track_ids;
+static size_t track_ids_cap, track_ids_count;
+static uint64_t track_id_state;
+
+/* open addressed (dev, ino) -> track table, one entry per file,
+ * its other tracks are reached through the ino_next ring */
+static struct track **track_inodes;
+static size_t track_inodes_cap, track_inodes_count;
+
 static struct tag *tag_alloc(const char *path, const char *fname);
 static void tag_free(struct tag *tag);
 
@@ -31,6 +79,29 @@ static struct track *track_alloc(const char *path, const char *fname);
 static void track_free(struct track *t);
 
 static bool tag_name_cmp(struct link *l1, struct link *l2);
+static bool track_listed(struct track *track);
+
+static uint64_t track_id_new(void);
+static void track_id_insert(struct track *track);
+static void track_id_remove(struct track *track);
+
+static size_t track_inode_hash(uint64_t dev, uint64_t ino);
+static void track_inode_insert(struct track *track);
+static void track_inode_remove(struct track *track);
+
+static void ids_push(struct id_list *ids, uint64_t id, const char *name);
+static void ids_load(struct id_list *ids, struct tag *tag);
+static uint64_t inodes_load(struct id_list *ids, struct tag *tag);
+static uint64_t ids_lookup(struct id_list *ids, const char *name);
+static void ids_index(struct id_list *ids);
+static void ids_free(struct id_list *ids);
+static uint64_t name_hash(const char *name);
+
+static bool copy_unsupported(int err);
+static ssize_t copy_range(int in, int out, struct copy_ctl *ctl);
+static ssize_t copy_sendfile(int in, int out, struct copy_ctl *ctl);
+static ssize_t copy_buffered(int in, int out, struct copy_ctl *ctl);
+static bool copy_fd(int in, int out, off_t size, struct copy_ctl *ctl);
 
 struct tag *
 tag_alloc(const char *path, const char *fname)
@@ -42,11 +113,13 @@ tag_alloc(const char *path, const char *fname)
 
 	tag->fpath = aprintf("%s/%s", path, fname);
 	tag->name = astrdup(fname);
+	dispstr_init(&tag->disp);
 	tag->index_dirty = false;
 	tag->reordered = false;
-	tag->link = LINK_EMPTY;
+	tag->link = ONODE_EMPTY;
 	tag->link_sel = LINK_EMPTY;
-	list_init(&tag->tracks);
+	olist_init(&tag->tracks);
+	memset(&tag->stats, 0, sizeof(struct track_stats));
 
 	return tag;
 }
@@ -56,7 +129,8 @@ tag_free(struct tag *tag)
 {
 	free(tag->fpath);
 	free(tag->name);
-	list_clear(&tag->tracks);
+	dispstr_clear(&tag->disp);
+	olist_clear(&tag->tracks);
 	free(tag);
 }
 
@@ -70,12 +144,23 @@ track_alloc(const char *dir, const char *fname)
 
 	track->fpath = aprintf("%s/%s", dir, fname);
 	track->name = astrdup(fname);
+	dispstr_init(&track->disp);
 	track->tag = NULL;
+	track->id = 0;
+	track->dev = 0;
+	track->ino = 0;
+	track->ino_next = track;
+	track->batch = 0;
+	track->meta = NULL;
+	track->size = 0;
+	track->duration = 0;
+	track->scanned = false;
 	track->link = LINK_EMPTY;
-	track->link_pl = LINK_EMPTY;
-	track->link_tt = LINK_EMPTY;
+	track->link_pl = ONODE_EMPTY;
+	track->link_tt = ONODE_EMPTY;
 	track->link_pq = LINK_EMPTY;
 	track->link_hs = LINK_EMPTY;
+	track->link_mk = LINK_EMPTY;
 
 	return track;
 }
@@ -85,6 +170,7 @@ track_free(struct track *t)
 {
 	free(t->fpath);
 	free(t->name);
+	dispstr_clear(&t->disp);
 	free(t);
 }
 
@@ -93,12 +179,384 @@ tag_name_cmp(struct link *l1, struct link *l2)
 {
 	struct tag *t1, *t2;
 
-	t1 = LINK_UPCAST(l1, struct tag, link);
-	t2 = LINK_UPCAST(l2, struct tag, link);
+	t1 = LINK_UPCAST(l1, struct tag, link.link);
+	t2 = LINK_UPCAST(l2, struct tag, link.link);
 
 	return strcmp(t1->name, t2->name) <= 0;
 }
 
+uint64_t
+track_id_new(void)
+{
+	uint64_t id;
+
+	/* splitmix64, unique enough to never collide in practice */
+	do {
+		track_id_state += 0x9E3779B97F4A7C15ULL;
+		id = track_id_state;
+		id = (id ^ (id >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		id = (id ^ (id >> 27)) * 0x94D049BB133111EBULL;
+		id ^= id >> 31;
+	} while (!id || track_find_id(id));
+
+	return id;
+}
+
+void
+track_id_insert(struct track *track)
+{
+	struct track **old;
+	size_t i, cap, mask;
+
+	/* grow at half load, probes stay short */
+	if ((track_ids_count + 1) * 2 > track_ids_cap) {
+		old = track_ids;
+		cap = track_ids_cap;
+		track_ids_cap = MAX(TRACK_IDS_MIN, cap * 2);
+		track_ids = calloc(track_ids_cap, sizeof(struct track *));
+		if (!track_ids) ERROR(SYSTEM, "calloc");
+		track_ids_count = 0;
+		for (i = 0; i < cap; i++) {
+			if (old[i]) track_id_insert(old[i]);
+		}
+		free(old);
+	}
+
+	mask = track_ids_cap - 1;
+	for (i = track->id & mask; track_ids[i]; i = (i + 1) & mask)
+		;
+	track_ids[i] = track;
+	track_ids_count += 1;
+}
+
+void
+track_id_remove(struct track *track)
+{
+	size_t i, j, home, mask;
+
+	if (!track_ids_cap) return;
+
+	mask = track_ids_cap - 1;
+	for (i = track->id & mask; track_ids[i] != track; i = (i + 1) & mask)
+		if (!track_ids[i]) return;
+
+	/* shift later entries of the probe run back into the gap */
+	track_ids[i] = NULL;
+	for (j = (i + 1) & mask; track_ids[j]; j = (j + 1) & mask) {
+		home = track_ids[j]->id & mask;
+		if ((j > i && (home <= i || home > j))
+				|| (j < i && home <= i && home > j)) {
+			track_ids[i] = track_ids[j];
+			track_ids[j] = NULL;
+			i = j;
+		}
+	}
+	track_ids_count -= 1;
+}
+
+struct track *
+track_find_id(uint64_t id)
+{
+	size_t i, mask;
+
+	if (!track_ids_cap || !id) return NULL;
+
+	mask = track_ids_cap - 1;
+	for (i = id & mask; track_ids[i]; i = (i + 1) & mask) {
+		if (track_ids[i]->id == id)
+			return track_ids[i];
+	}
+
+	return NULL;
+}
+
+void
+track_set_id(struct track *track, uint64_t id)
+{
+	if (!id || id == track->id || track_find_id(id))
+		return;
+
+	track_id_remove(track);
+	track->id = id;
+	track_id_insert(track);
+
+	/* the last record of a track decides on replay */
+	journal_track_add(track);
+}
+
+size_t
+track_inode_hash(uint64_t dev, uint64_t ino)
+{
+	uint64_t h;
+
+	h = ino ^ (dev * 0x9E3779B97F4A7C15ULL);
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 31;
+
+	return h;
+}
+
+void
+track_inode_insert(struct track *track)
+{
+	struct track **old, *head;
+	size_t i, cap, mask;
+
+	/* grow at half load, only ring heads are rehashed */
+	if ((track_inodes_count + 1) * 2 > track_inodes_cap) {
+		old = track_inodes;
+		cap = track_inodes_cap;
+		track_inodes_cap = MAX(TRACK_INODES_MIN, cap * 2);
+		track_inodes = calloc(track_inodes_cap, sizeof(struct track *));
+		if (!track_inodes) ERROR(SYSTEM, "calloc");
+		track_inodes_count = 0;
+		for (i = 0; i < cap; i++) {
+			if (old[i]) track_inode_insert(old[i]);
+		}
+		free(old);
+	}
+
+	mask = track_inodes_cap - 1;
+	i = track_inode_hash(track->dev, track->ino) & mask;
+	for (; (head = track_inodes[i]); i = (i + 1) & mask) {
+		if (head->dev == track->dev && head->ino == track->ino) {
+			/* another name for a known file joins its ring */
+			track->ino_next = head->ino_next;
+			head->ino_next = track;
+			return;
+		}
+	}
+	track_inodes[i] = track;
+	track_inodes_count += 1;
+}
+
+void
+track_inode_remove(struct track *track)
+{
+	struct track *head, *prev;
+	size_t i, j, home, mask;
+
+	if (!track_inodes_cap || !track->ino) return;
+
+	mask = track_inodes_cap - 1;
+	i = track_inode_hash(track->dev, track->ino) & mask;
+	for (; (head = track_inodes[i]); i = (i + 1) & mask) {
+		if (head->dev == track->dev && head->ino == track->ino)
+			break;
+	}
+	if (!head) return;
+
+	/* the file keeps its entry while other tracks name it */
+	if (track->ino_next != track) {
+		for (prev = track; prev->ino_next != track; )
+			prev = prev->ino_next;
+		prev->ino_next = track->ino_next;
+		if (head == track)
+			track_inodes[i] = track->ino_next;
+		track->ino_next = track;
+		return;
+	}
+	if (head != track) return;
+
+	/* shift later entries of the probe run back into the gap */
+	track_inodes[i] = NULL;
+	for (j = (i + 1) & mask; track_inodes[j]; j = (j + 1) & mask) {
+		head = track_inodes[j];
+		home = track_inode_hash(head->dev, head->ino) & mask;
+		if ((j > i && (home <= i || home > j))
+				|| (j < i && home <= i && home > j)) {
+			track_inodes[i] = head;
+			track_inodes[j] = NULL;
+			i = j;
+		}
+	}
+	track_inodes_count -= 1;
+}
+
+void
+track_set_inode(struct track *track, uint64_t dev, uint64_t ino)
+{
+	if (track->dev == dev && track->ino == ino)
+		return;
+
+	track_inode_remove(track);
+	track->dev = dev;
+	track->ino = ino;
+	if (ino) track_inode_insert(track);
+}
+
+bool
+track_stat_inode(struct track *track)
+{
+	struct stat st;
+
+	if (stat(track->fpath, &st)) {
+		track_set_inode(track, 0, 0);
+		return false;
+	}
+
+	track_set_inode(track, st.st_dev, st.st_ino);
+
+	return true;
+}
+
+struct track *
+track_in_tag(struct track *track, struct tag *tag)
+{
+	struct track *it;
+
+	/* other tags of the file, without scanning their tracks */
+	it = track;
+	do {
+		if (it->tag == tag)
+			return it;
+		it = it->ino_next;
+	} while (it != track);
+
+	return NULL;
+}
+
+void
+ids_push(struct id_list *ids, uint64_t id, const char *name)
+{
+	if (ids->count == ids->cap) {
+		ids->cap = MAX(64, ids->cap * 2);
+		ids->entries = realloc(ids->entries,
+			ids->cap * sizeof(struct id_entry));
+		if (!ids->entries) ERROR(SYSTEM, "realloc");
+	}
+
+	ids->entries[ids->count].id = id;
+	ids->entries[ids->count].name = astrdup(name);
+	ids->count += 1;
+}
+
+void
+ids_load(struct id_list *ids, struct tag *tag)
+{
+	char linebuf[1024];
+	char *path, *end;
+	FILE *file;
+	uint64_t id;
+
+	path = aprintf("%s/.ids", tag->fpath);
+	file = fopen(path, "r");
+	free(path);
+	if (!file) return;
+
+	while (fgets(linebuf, sizeof(linebuf), file)) {
+		end = strchr(linebuf, '\n');
+		if (!end || end - linebuf < 18 || linebuf[16] != ' ')
+			continue;
+		*end = '\0';
+		id = strtoull(linebuf, &end, 16);
+		if (end != linebuf + 16) continue;
+		ids_push(ids, id, linebuf + 17);
+	}
+
+	fclose(file);
+}
+
+uint64_t
+inodes_load(struct id_list *ids, struct tag *tag)
+{
+	struct dirent *ent;
+	struct stat st;
+	DIR *dir;
+
+	/* d_ino saves a stat per track, one for the device suffices */
+	dir = opendir(tag->fpath);
+	if (!dir) return 0;
+
+	if (fstat(dirfd(dir), &st)) {
+		closedir(dir);
+		return 0;
+	}
+
+	while ((ent = readdir(dir))) {
+		if (!strcmp(ent->d_name, "."))
+			continue;
+		if (!strcmp(ent->d_name, ".."))
+			continue;
+		ids_push(ids, ent->d_ino, ent->d_name);
+	}
+
+	closedir(dir);
+
+	return st.st_dev;
+}
+
+uint64_t
+ids_lookup(struct id_list *ids, const char *name)
+{
+	struct id_entry *entry;
+	size_t i, mask;
+
+	/* usually in the same order as the tracks */
+	if (!ids->indexed && ids->cursor < ids->count
+			&& !strcmp(ids->entries[ids->cursor].name, name))
+		return ids->entries[ids->cursor++].id;
+
+	/* directory order is not, hashing beats sorting there */
+	if (!ids->indexed)
+		ids_index(ids);
+
+	mask = ids->slots_cap - 1;
+	for (i = name_hash(name) & mask; ids->slots[i]; i = (i + 1) & mask) {
+		entry = &ids->entries[ids->slots[i] - 1];
+		if (!strcmp(entry->name, name))
+			return entry->id;
+	}
+
+	return 0;
+}
+
+void
+ids_index(struct id_list *ids)
+{
+	size_t i, k, mask;
+
+	ids->slots_cap = 16;
+	while (ids->slots_cap < ids->count * 2)
+		ids->slots_cap *= 2;
+	ids->slots = calloc(ids->slots_cap, sizeof(size_t));
+	if (!ids->slots) ERROR(SYSTEM, "calloc");
+
+	mask = ids->slots_cap - 1;
+	for (k = 0; k < ids->count; k++) {
+		i = name_hash(ids->entries[k].name) & mask;
+		while (ids->slots[i])
+			i = (i + 1) & mask;
+		ids->slots[i] = k + 1;
+	}
+
+	ids->indexed = true;
+}
+
+void
+ids_free(struct id_list *ids)
+{
+	size_t i;
+
+	for (i = 0; i < ids->count; i++)
+		free(ids->entries[i].name);
+	free(ids->entries);
+	free(ids->slots);
+}
+
+uint64_t
+name_hash(const char *name)
+{
+	uint64_t h;
+
+	/* FNV-1a */
+	h = 0xCBF29CE484222325ULL;
+	for (; *name; name++)
+		h = (h ^ (uint8_t) *name) * 0x100000001B3ULL;
+
+	return h;
+}
+
 bool
 path_exists(const char *path)
 {
@@ -163,46 +621,190 @@ rm_file(const char *path)
 	return unlink(path) == 0;
 }
 
+bool
+copy_unsupported(int err)
+{
+	/* reasons to fall back to the next method, as long
+	 * as nothing was copied yet */
+	return err == ENOSYS || err == EXDEV || err == EINVAL
+		|| err == EOPNOTSUPP || err == ENOTSUP;
+}
+
+bool
+copy_ctl_step(struct copy_ctl *ctl, size_t n)
+{
+	if (!ctl) return true;
+
+	atomic_fetch_add(&ctl->done, n);
+	if (atomic_load(&ctl->cancel)) {
+		errno = ECANCELED;
+		return false;
+	}
+
+	return true;
+}
+
+ssize_t
+copy_range(int in, int out, struct copy_ctl *ctl)
+{
+	ssize_t n, total;
+
+	total = 0;
+	while ((n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0))) {
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return total ? -1 : -2;
+		if (!copy_ctl_step(ctl, n)) return -1;
+		total += n;
+	}
+
+	return total;
+}
+
+ssize_t
+copy_sendfile(int in, int out, struct copy_ctl *ctl)
+{
+	ssize_t n, total;
+
+	total = 0;
+	while ((n = sendfile(out, in, NULL, COPY_CHUNK))) {
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return total ? -1 : -2;
+		if (!copy_ctl_step(ctl, n)) return -1;
+		total += n;
+	}
+
+	return total;
+}
+
+ssize_t
+copy_buffered(int in, int out, struct copy_ctl *ctl)
+{
+	ssize_t nread, nwrite, off, total;
+	char *buf;
+
+	buf = malloc(COPY_BUFSIZE);
+	if (!buf) ERROR(SYSTEM, "malloc");
+
+	total = 0;
+	while ((nread = read(in, buf, COPY_BUFSIZE))) {
+		if (nread < 0 && errno == EINTR) continue;
+		if (nread < 0) goto fail;
+
+		for (off = 0; off < nread; off += nwrite) {
+			nwrite = write(out, buf + off, nread - off);
+			if (nwrite < 0 && errno == EINTR) nwrite = 0;
+			else if (nwrite <= 0) goto fail;
+		}
+		if (!copy_ctl_step(ctl, nread)) goto fail;
+		total += nread;
+	}
+
+	free(buf);
+
+	return total;
+
+fail:
+	free(buf);
+
+	return -1;
+}
+
+bool
+copy_fd(int in, int out, off_t size, struct copy_ctl *ctl)
+{
+	ssize_t copied;
+
+#ifdef FICLONE
+	/* share extents on filesystems that support reflinks */
+	if (ioctl(out, FICLONE, in) == 0) {
+		if (ctl) atomic_fetch_add(&ctl->done, size);
+		return true;
+	}
+#endif
+
+	/* reserve space up front, fails early when the target
+	 * is full and keeps large files unfragmented */
+	if (size > 0 && fallocate(out, 0, 0, size) != 0) {
+		if (errno == ENOSPC || errno == EFBIG)
+			return false;
+	}
+
+	/* -2: method unsupported for these files, try the next */
+	copied = copy_range(in, out, ctl);
+	if (copied == -2 && copy_unsupported(errno))
+		copied = copy_sendfile(in, out, ctl);
+	if (copied == -2 && copy_unsupported(errno))
+		copied = copy_buffered(in, out, ctl);
+	if (copied < 0)
+		return false;
+
+	/* drop preallocated space if the source shrunk */
+	if (copied < size && ftruncate(out, copied) != 0)
+		return false;
+
+	return true;
+}
+
 bool
 copy_file(const char *src, const char *dst)
 {
-	FILE *in, *out;
-	char buf[4096];
-	int nread;
-	bool ok;
+	return copy_file_ctl(src, dst, NULL);
+}
 
-	ok = false;
-	in = out = NULL;
+bool
+copy_file_ctl(const char *src, const char *dst, struct copy_ctl *ctl)
+{
+	struct stat st;
+	int in, out;
+	bool ok;
 
-	in = fopen(src, "r");
-	if (in == NULL) goto cleanup;
+	in = open(src, O_RDONLY | O_CLOEXEC);
+	if (in < 0) return false;
 
-	out = fopen(dst, "w+");
-	if (out == NULL) goto cleanup;
+	if (fstat(in, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(in);
+		return false;
+	}
 
-	while ((nread = fread(buf, 1, sizeof(buf), in)) > 0) {
-		fwrite(buf, 1, nread, out);
+	/* never replace an existing file, callers check
+	 * beforehand but queued jobs may race each other */
+	out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if (out < 0) {
+		close(in);
+		return false;
 	}
 
-	if (nread < 0)
-		goto cleanup;
+	ok = copy_fd(in, out, st.st_size, ctl);
 
-	ok = true;
+	/* delayed write errors show up on close */
+	if (close(out) != 0)
+		ok = false;
+	close(in);
 
-cleanup:
-	if (in) fclose(in);
-	if (out) fclose(out);
+	/* leave no partial copy behind */
+	if (!ok) unlink(dst);
 
 	return ok;
 }
 
 bool
 dup_file(const char *src, const char *dst)
+{
+	return dup_file_ctl(src, dst, NULL);
+}
+
+bool
+dup_file_ctl(const char *src, const char *dst, struct copy_ctl *ctl)
 {
 	if (link(src, dst) == 0)
 		return true;
 
-	return copy_file(src, dst);
+	/* only fall back to copying across filesystems and
+	 * on filesystems without hard links */
+	if (errno == EEXIST || errno == ENOENT)
+		return false;
+
+	return copy_file_ctl(src, dst, ctl);
 }
 
 bool
@@ -217,9 +819,9 @@ tag_clear_tracks(struct tag *tag)
 	struct link *link;
 	struct track *track;
 
-	while (!list_empty(&tag->tracks)) {
-		link = list_pop_front(&tag->tracks);
-		track = UPCAST(link, struct track, link_tt);
+	while (!olist_empty(&tag->tracks)) {
+		link = list_front(&tag->tracks.list);
+		track = UPCAST(link, struct track, link_tt.link);
 		track_rm(track, false);
 	}
 }
@@ -227,26 +829,37 @@ tag_clear_tracks(struct tag *tag)
 void
 tag_load_tracks(struct tag *tag)
 {
+	struct id_list ids = { 0 }, inodes = { 0 };
+	struct track *track;
 	char linebuf[1024];
 	char *index_path;
 	FILE *file;
+	uint64_t dev;
 
 	index_path = aprintf("%s/index", tag->fpath);
 	file = fopen(index_path, "r");
 	if (file == NULL) {
+		free(index_path);
 		tag_reindex_tracks(tag);
 		return;
 	}
 
+	/* tracks missing from .ids get new ids and a rewrite */
+	ids_load(&ids, tag);
+	dev = inodes_load(&inodes, tag);
+
 	while (fgets(linebuf, sizeof(linebuf), file)) {
 		if (!*linebuf) continue;
 		if (linebuf[strlen(linebuf) - 1] == '\n')
 			linebuf[strlen(linebuf) - 1] = '\0';
-		track_add(tag, linebuf);
+		track = track_add_id(tag, linebuf, ids_lookup(&ids, linebuf));
+		track_set_inode(track, dev, ids_lookup(&inodes, linebuf));
 	}
 
-	tag->index_dirty = false;
+	tag->index_dirty = ids.indexed || ids.cursor != ids.count;
 
+	ids_free(&inodes);
+	ids_free(&ids);
 	fclose(file);
 	free(index_path);
 }
@@ -256,8 +869,11 @@ tag_save_tracks(struct tag *tag)
 {
 	struct track *track;
 	struct link *link;
-	char *index_path;
-	FILE *file;
+	char *index_path, *ids_path;
+	FILE *file, *ids_file;
+
+	/* a compaction of older state must not land after this */
+	journal_wait();
 
 	/* write playlist back to index file */
 
@@ -270,26 +886,54 @@ tag_save_tracks(struct tag *tag)
 		return;
 	}
 
-	for (LIST_ITER(&tag->tracks, link)) {
-		track = UPCAST(link, struct track, link_tt);
+	/* track ids go to a sidecar in the same order */
+	ids_path = aprintf("%s/.ids", tag->fpath);
+	ids_file = fopen(ids_path, "w+");
+	if (!ids_file)
+		WARNX(SYSTEM, "Failed to write to ids file: %s", ids_path);
+
+	for (LIST_ITER(&tag->tracks.list, link)) {
+		track = UPCAST(link, struct track, link_tt.link);
 		fprintf(file, "%s\n", track->name);
+		if (ids_file)
+			fprintf(ids_file, "%016" PRIx64 " %s\n",
+				track->id, track->name);
 	}
 
+	if (ids_file) fclose(ids_file);
+	fclose(file);
+
 	tag->index_dirty = false;
+	journal_tag_reset(tag);
 
-	fclose(file);
+	free(ids_path);
 	free(index_path);
 }
 
 bool
 tag_reindex_tracks(struct tag *tag)
 {
+	struct id_list ids = { 0 };
 	struct dirent *ent;
+	struct track *track;
+	struct link *link;
+	struct stat st;
 	DIR *dir;
 
 	dir = opendir(tag->fpath);
 	if (!dir) return false;
 
+	if (fstat(dirfd(dir), &st))
+		st.st_dev = 0;
+
+	/* files still there keep their ids */
+	for (LIST_ITER(&tag->tracks.list, link)) {
+		track = UPCAST(link, struct track, link_tt.link);
+		ids_push(&ids, track->id, track->name);
+	}
+	if (ids.count == 0)
+		ids_load(&ids, tag);
+
 	tag_clear_tracks(tag);
 
 	while ((ent = readdir(dir))) {
@@ -302,11 +946,14 @@ tag_reindex_tracks(struct tag *tag)
 		if (!strchr(ent->d_name + 1, '.'))
 			continue;
 
-		track_add(tag, ent->d_name);
+		track = track_add_id(tag, ent->d_name,
+			ids_lookup(&ids, ent->d_name));
+		if (st.st_dev) track_set_inode(track, st.st_dev, ent->d_ino);
 	}
 
 	tag->index_dirty = true;
 
+	ids_free(&ids);
 	closedir(dir);
 
 	return true;
@@ -316,17 +963,53 @@ struct track *
 tracks_vis_track(struct link *link)
 {
 	if (tracks_vis == &player.playlist) {
-		return UPCAST(link, struct track, link_pl);
+		return UPCAST(link, struct track, link_pl.link);
 	} else {
-		return UPCAST(link, struct track, link_tt);
+		return UPCAST(link, struct track, link_tt.link);
 	}
 }
 
+void
+track_stats_add(struct track_stats *stats, struct track *track)
+{
+	stats->count += 1;
+	if (track->scanned) {
+		stats->scanned += 1;
+		stats->size += track->size;
+		stats->duration += track->duration;
+	}
+}
+
+void
+track_stats_rm(struct track_stats *stats, struct track *track)
+{
+	stats->count -= 1;
+	if (track->scanned) {
+		stats->scanned -= 1;
+		stats->size -= track->size;
+		stats->duration -= track->duration;
+	}
+}
+
+bool
+track_listed(struct track *track)
+{
+	struct track *it;
+
+	for (it = track->ino_next; it != track; it = it->ino_next) {
+		if (onode_inuse(&it->link_pl))
+			return true;
+	}
+
+	return false;
+}
+
 void
 playlist_clear(void)
 {
-	while (!list_empty(&player.playlist))
-		list_pop_front(&player.playlist);
+	while (!olist_empty(&player.playlist))
+		olist_pop_front(&player.playlist);
+	memset(&player.playlist_stats, 0, sizeof(struct track_stats));
 }
 
 void
@@ -343,14 +1026,22 @@ playlist_update(void)
 
 	for (LIST_ITER(&tags_sel, link)) {
 		tag = UPCAST(link, struct tag, link_sel);
-		for (LIST_ITER(&tag->tracks, link2)) {
-			track = UPCAST(link2, struct track, link_tt);
-			link_pop(&track->link_pl);
-			list_push_back(&player.playlist, &track->link_pl);
+		for (LIST_ITER(&tag->tracks.list, link2)) {
+			track = UPCAST(link2, struct track, link_tt.link);
+			onode_pop(&track->link_pl);
+
+			/* a file in several selected tags is listed once */
+			if (track->ino_next != track && track_listed(track))
+				continue;
+
+			olist_push_back(&player.playlist, &track->link_pl);
+			track_stats_add(&player.playlist_stats, track);
 		}
 	}
 
 	playlist_outdated = false;
+
+	tui_damage(DAMAGE_TRACKS);
 }
 
 struct tag *
@@ -382,7 +1073,9 @@ tag_add(const char *fname)
 
 	tag = tag_alloc(datadir, fname);
 	if (!tag) return NULL;
-	list_push_back(&tags, &tag->link);
+	olist_push_back(&tags, &tag->link);
+
+	tui_damage(DAMAGE_TAGS);
 
 	return tag;
 }
@@ -393,8 +1086,8 @@ tag_find(const char *name)
 	struct link *link;
 	struct tag *tag;
 
-	for (LIST_ITER(&tags, link)) {
-		tag = UPCAST(link, struct tag, link);
+	for (LIST_ITER(&tags.list, link)) {
+		tag = UPCAST(link, struct tag, link.link);
 		if (!strcmp(tag->name, name))
 			return tag;
 	}
@@ -409,9 +1102,9 @@ tag_rm(struct tag *tag, bool sync_fs)
 	struct track *track;
 
 	/* remove contained tracks */
-	while (!list_empty(&tag->tracks)) {
-		link = list_pop_front(&tag->tracks);
-		track = UPCAST(link, struct track, link_tt);
+	while (!olist_empty(&tag->tracks)) {
+		link = list_front(&tag->tracks.list);
+		track = UPCAST(link, struct track, link_tt.link);
 		if (!track_rm(track, sync_fs))
 			return false;
 	}
@@ -424,10 +1117,18 @@ tag_rm(struct tag *tag, bool sync_fs)
 	link_pop(&tag->link_sel);
 
 	/* remove from tags list */
-	link_pop(&tag->link);
+	onode_pop(&tag->link);
+
+	/* pending jobs must not touch it anymore */
+	job_forget_tag(tag);
+
+	/* a new tag by the same name starts clean */
+	journal_tag_reset(tag);
 
 	tag_free(tag);
 
+	tui_damage(DAMAGE_TAGS | DAMAGE_TRACKS);
+
 	return true;
 }
 
@@ -440,6 +1141,9 @@ tag_rename(struct tag *tag, const char *name)
 
 	newpath = aprintf("%s/%s", datadir, name);
 
+	/* journal records still name the old tag */
+	tag_save_tracks(tag);
+
 	if (!move_dir(tag->fpath, newpath)) {
 		free(newpath);
 		return false;
@@ -450,13 +1154,16 @@ tag_rename(struct tag *tag, const char *name)
 
 	free(tag->name);
 	tag->name = astrdup(name);
+	dispstr_clear(&tag->disp);
 
-	for (LIST_ITER(&tag->tracks, link)) {
-		track = UPCAST(link, struct track, link_tt);
+	for (LIST_ITER(&tag->tracks.list, link)) {
+		track = UPCAST(link, struct track, link_tt.link);
 		free(track->fpath);
 		track->fpath = aprintf("%s/%s", newpath, track->name);
 	}
 
+	tui_damage(DAMAGE_TAGS | DAMAGE_TRACKS);
+
 	return true;
 }
 
@@ -465,14 +1172,32 @@ track_add(struct tag *tag, const char *fname)
 {
 	struct track *track;
 
+	track = track_add_id(tag, fname, 0);
+	track_stat_inode(track);
+
+	return track;
+}
+
+struct track *
+track_add_id(struct tag *tag, const char *fname, uint64_t id)
+{
+	struct track *track;
+
 	track = track_alloc(tag->fpath, fname);
 	track->tag = tag;
 
+	/* ids taken by another track are not reused */
+	track->id = id && !track_find_id(id) ? id : track_id_new();
+	track_id_insert(track);
+
 	/* insert track into sorted tracks list */
 	list_push_back(&tracks, &track->link);
+	meta_track_added(track);
 
 	/* add to tag's tracks list */
-	list_push_back(&tag->tracks, &track->link_tt);
+	olist_push_back(&tag->tracks, &track->link_tt);
+	track_stats_add(&tag->stats, track);
+	journal_track_add(track);
 
 	/* if track's tag is selected, update playlist */
 	if (link_inuse(&tag->link_sel))
@@ -480,6 +1205,9 @@ track_add(struct tag *tag, const char *fname)
 
 	tag->index_dirty = true;
 
+	/* tag pane shows track counts */
+	tui_damage(DAMAGE_TAGS | DAMAGE_TRACKS);
+
 	return track;
 }
 
@@ -490,28 +1218,52 @@ track_rm(struct track *track, bool sync_fs)
 		return false;
 
 	track->tag->index_dirty = true;
+	journal_track_rm(track);
+
+	/* while the scanner can still find the next track */
+	meta_forget_track(track);
 
 	/* remove from tracks list */
 	link_pop(&track->link);
 
 	/* remove from tag's track list */
-	link_pop(&track->link_tt);
-
-	/* remove from playlist */
-	link_pop(&track->link_pl);
+	if (onode_inuse(&track->link_tt))
+		track_stats_rm(&track->tag->stats, track);
+	onode_pop(&track->link_tt);
+
+	/* remove from playlist, another name of the file may take its place */
+	if (onode_inuse(&track->link_pl)) {
+		track_stats_rm(&player.playlist_stats, track);
+		if (track->ino_next != track)
+			playlist_outdated = true;
+	}
+	onode_pop(&track->link_pl);
 
 	/* remove from player queue */
-	link_pop(&track->link_pq);
+	player_queue_rm(track);
 
 	/* remove from player history */
 	link_pop(&track->link_hs);
 
+	/* remove from marked tracks */
+	if (link_inuse(&track->link_mk)) {
+		link_pop(&track->link_mk);
+		tracks_marked_count -= 1;
+	}
+
 	/* remove the reference as last used track */
 	if (player.track == track)
 		player.track = NULL;
 
+	job_forget_track(track);
+
+	track_id_remove(track);
+	track_inode_remove(track);
+
 	track_free(track);
 
+	tui_damage(DAMAGE_TAGS | DAMAGE_TRACKS);
+
 	return true;
 }
 
@@ -535,11 +1287,16 @@ track_rename(struct track *track, const char *name)
 	free(track->fpath);
 	track->fpath = newpath;
 
+	journal_track_rm(track);
 	free(track->name);
 	track->name = astrdup(name);
+	dispstr_clear(&track->disp);
+	journal_track_add(track);
 
 	track->tag->index_dirty = true;
 
+	tui_damage(DAMAGE_TRACKS);
+
 	return true;
 }
 
@@ -548,6 +1305,7 @@ track_move(struct track *track, struct tag *tag)
 {
 	struct track *new;
 	char *newpath;
+	uint64_t id;
 
 	errno = 0;
 
@@ -572,12 +1330,44 @@ track_move(struct track *track, struct tag *tag)
 	if (player.track == track)
 		player.track = new;
 
+	id = track->id;
 	if (!track_rm(track, true)) {
 		track_rm(new, true);
 		errno = EACCES;
 		return false;
 	}
 
+	/* a moved track stays the same track */
+	track_set_id(new, id);
+
+	return true;
+}
+
+bool
+track_scanned(struct track *track, uint64_t size, uint32_t duration)
+{
+	bool in_tag, in_pl, in_pq;
+
+	if (track->scanned && track->size == size
+			&& track->duration == duration)
+		return false;
+
+	/* swap the old contribution for the new one */
+	in_tag = onode_inuse(&track->link_tt);
+	in_pl = onode_inuse(&track->link_pl);
+	in_pq = link_inuse(&track->link_pq);
+	if (in_tag) track_stats_rm(&track->tag->stats, track);
+	if (in_pl) track_stats_rm(&player.playlist_stats, track);
+	if (in_pq) track_stats_rm(&player.queue_stats, track);
+
+	track->size = size;
+	track->duration = duration;
+	track->scanned = true;
+
+	if (in_tag) track_stats_add(&track->tag->stats, track);
+	if (in_pl) track_stats_add(&player.playlist_stats, track);
+	if (in_pq) track_stats_add(&player.queue_stats, track);
+
 	return true;
 }
 
@@ -649,9 +1439,14 @@ data_load(void)
 	DIR *dir;
 
 	list_init(&tracks);
-	list_init(&tags);
+	olist_init(&tags);
 	list_init(&tags_sel);
 
+	/* ids of new tracks must not repeat those of earlier runs */
+	if (getrandom(&track_id_state, sizeof(track_id_state), 0)
+			!= sizeof(track_id_state))
+		track_id_state = current_ms() ^ getpid();
+
 	datadir = getenv("TMUS_DATA");
 	if (!datadir) ERRORX(USER, "TMUS_DATA not set");
 
@@ -678,7 +1473,11 @@ data_load(void)
 		free(path);
 	}
 
-	list_sort(&tags, false, tag_name_cmp);
+	olist_sort(&tags, false, tag_name_cmp);
+
+	/* changes not yet in the index files when tmus last quit */
+	journal_replay();
+	journal_open();
 
 	playlist_outdated = true;
 
@@ -691,12 +1490,17 @@ data_save(void)
 	struct link *link;
 	struct tag *tag;
 
-	for (LIST_ITER(&tags, link)) {
-		tag = UPCAST(link, struct tag, link);
+	/* a failed compaction marks every tag dirty */
+	journal_wait();
+
+	for (LIST_ITER(&tags.list, link)) {
+		tag = UPCAST(link, struct tag, link.link);
 		if (tag->index_dirty)
 			tag_save_tracks(tag);
 	}
 
+	journal_close();
+
 	release_lock(datadir);
 }
 
@@ -706,14 +1510,22 @@ data_free(void)
 	struct link *link;
 	struct tag *tag;
 
-	list_clear(&player.playlist);
-	list_clear(&player.queue);
+	playlist_clear();
+	player_queue_clear();
 	list_clear(&player.history);
 
-	while (!list_empty(&tags)) {
-		link = list_pop_front(&tags);
-		tag = UPCAST(link, struct tag, link);
+	while (!olist_empty(&tags)) {
+		link = olist_pop_front(&tags);
+		tag = UPCAST(link, struct tag, link.link);
 		tag_rm(tag, false);
 	}
+
+	free(track_ids);
+	track_ids = NULL;
+	track_ids_cap = track_ids_count = 0;
+
+	free(track_inodes);
+	track_inodes = NULL;
+	track_inodes_cap = track_inodes_count = 0;
 }
 
@@ -1,28 +1,62 @@
 #pragma once
 
 #include "list.h"
+#include "olist.h"
+#include "dispstr.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+struct meta;
+
+/* sums over a set of tracks, kept up to date as it changes,
+ * sizes and durations only cover the scanned tracks */
+struct track_stats {
+	int count, scanned;
+	uint64_t size;
+	uint64_t duration; /* ms */
+};
 
 struct tag {
 	char *name, *fpath;
-	struct list tracks;
+	struct dispstr disp;
+	struct olist tracks;
+	struct track_stats stats;
 	bool index_dirty;
 	bool reordered;
 
-	struct link link;     /* tags list */
+	struct onode link;    /* tags list */
 	struct link link_sel; /* selected tags list */ 
 };
 
+/* progress and cancellation of a copy in another thread */
+struct copy_ctl {
+	_Atomic uint64_t done;
+	_Atomic bool cancel;
+};
+
 struct track {
 	char *name, *fpath;
+	struct dispstr disp;
 	struct tag *tag;
+	uint64_t id;         /* stable across runs and moves, never 0 */
+	uint64_t dev, ino;   /* file identity, 0 until known */
+	struct track *ino_next; /* ring of tracks naming the same file */
+	unsigned int batch;  /* last batch that took the track, see cmd_tag */
+	struct meta *meta;   /* header metadata, see meta.h */
+
+	/* last scanned values, kept when meta is evicted */
+	uint64_t size;
+	uint32_t duration;
+	bool scanned;
 
 	struct link link;    /* tracks list */
-	struct link link_pl; /* player playlist */
-	struct link link_tt; /* tag tracks list */
+	struct onode link_pl; /* player playlist */
+	struct onode link_tt; /* tag tracks list */
 	struct link link_pq; /* player queue */
 	struct link link_hs; /* player history */
+	struct link link_mk; /* marked tracks list */
 };
 
 bool path_exists(const char *path);
@@ -32,10 +66,17 @@ bool rm_dir(const char *path, bool recursive);
 bool rm_file(const char *path);
 bool copy_file(const char *dst, const char *src);
 bool dup_file(const char *dst, const char *src);
+bool copy_file_ctl(const char *src, const char *dst, struct copy_ctl *ctl);
+bool dup_file_ctl(const char *src, const char *dst, struct copy_ctl *ctl);
+/* counts progress, false with ECANCELED once canceled */
+bool copy_ctl_step(struct copy_ctl *ctl, size_t n);
 bool move_file(const char *dst, const char *src);
 
 struct track *tracks_vis_track(struct link *link);
 
+void track_stats_add(struct track_stats *stats, struct track *track);
+void track_stats_rm(struct track_stats *stats, struct track *track);
+
 void playlist_clear(void);
 void playlist_update(void);
 
@@ -51,9 +92,18 @@ void tag_save_tracks(struct tag *tag);
 bool tag_reindex_tracks(struct tag *tag);
 
 struct track *track_add(struct tag *tag, const char *fname);
+struct track *track_add_id(struct tag *tag, const char *fname, uint64_t id);
 bool track_rm(struct track *track, bool sync_fs);
 bool track_rename(struct track *track, const char *name);
 bool track_move(struct track *track, struct tag *tag);
+bool track_scanned(struct track *track, uint64_t size, uint32_t duration);
+
+struct track *track_find_id(uint64_t id);
+void track_set_id(struct track *track, uint64_t id);
+
+void track_set_inode(struct track *track, uint64_t dev, uint64_t ino);
+bool track_stat_inode(struct track *track);
+struct track *track_in_tag(struct track *track, struct tag *tag);
 
 bool acquire_lock(const char *path);
 bool release_lock(const char *path);
@@ -65,7 +115,7 @@ void data_free(void);
 extern const char *datadir;
 
 extern struct list tracks; /* struct track (link) */
-extern struct list tags; /* struct track (link) */
+extern struct olist tags; /* struct tag (link) */
 extern struct list tags_sel; /* struct tag (link_sel) */
 
 extern struct tag *trash_tag;
@@ -0,0 +1,628 @@
+#include "dedup.h"
+
+#include "data.h"
+#include "hash.h"
+#include "job.h"
+#include "list.h"
+#include "log.h"
+#include "tui.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DEDUP_BUFSIZE (1UL << 20)
+
+struct dedup_file {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+
+	/* one of the tracks using this inode */
+	char *path;
+	uint64_t id;
+
+	bool found, candidate, hashed;
+	uint64_t hash;
+};
+
+/* hashes from earlier runs, valid while size and mtime match */
+struct dedup_entry {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	uint64_t hash;
+};
+
+static int file_ino_cmp(const void *a, const void *b);
+static int file_size_cmp(const void *a, const void *b);
+static int file_hash_cmp(const void *a, const void *b);
+static int entry_cmp(const void *a, const void *b);
+static struct dedup_entry *cache_find(struct dedup_file *file);
+static ssize_t read_full(int fd, char *buf, size_t len);
+static void dedup_collect(void);
+static void dedup_group(void);
+static void dedup_hash_start(void);
+static void dedup_cache_load(void);
+static void dedup_cache_save(void);
+static void dedup_finish(void);
+static void dedup_free(void);
+
+static struct dedup_file *files;
+static size_t file_count;
+
+static struct dedup_entry *cache;
+static size_t cache_count;
+
+/* stat jobs, then hash jobs */
+static int dedup_pending;
+static bool dedup_canceled;
+static bool link_dups;
+
+int
+file_ino_cmp(const void *a, const void *b)
+{
+	const struct dedup_file *f1 = a, *f2 = b;
+
+	if (f1->dev != f2->dev)
+		return f1->dev < f2->dev ? -1 : 1;
+	if (f1->ino != f2->ino)
+		return f1->ino < f2->ino ? -1 : 1;
+
+	return 0;
+}
+
+int
+file_size_cmp(const void *a, const void *b)
+{
+	const struct dedup_file *f1 = a, *f2 = b;
+
+	if (f1->size != f2->size)
+		return f1->size < f2->size ? -1 : 1;
+
+	return file_ino_cmp(a, b);
+}
+
+int
+file_hash_cmp(const void *a, const void *b)
+{
+	const struct dedup_file *f1 = a, *f2 = b;
+
+	/* hashed files first, grouped by content */
+	if (f1->hashed != f2->hashed)
+		return f1->hashed ? -1 : 1;
+	if (f1->size != f2->size)
+		return f1->size < f2->size ? -1 : 1;
+	if (f1->hash != f2->hash)
+		return f1->hash < f2->hash ? -1 : 1;
+
+	return file_ino_cmp(a, b);
+}
+
+int
+entry_cmp(const void *a, const void *b)
+{
+	const struct dedup_entry *e1 = a, *e2 = b;
+
+	if (e1->dev != e2->dev)
+		return e1->dev < e2->dev ? -1 : 1;
+	if (e1->ino != e2->ino)
+		return e1->ino < e2->ino ? -1 : 1;
+
+	return 0;
+}
+
+struct dedup_entry *
+cache_find(struct dedup_file *file)
+{
+	struct dedup_entry key, *entry;
+
+	key.dev = file->dev;
+	key.ino = file->ino;
+	entry = bsearch(&key, cache, cache_count,
+		sizeof(struct dedup_entry), entry_cmp);
+	if (!entry) return NULL;
+
+	if (entry->size != file->size
+			|| entry->mtime.tv_sec != file->mtime.tv_sec
+			|| entry->mtime.tv_nsec != file->mtime.tv_nsec)
+		return NULL;
+
+	return entry;
+}
+
+ssize_t
+read_full(int fd, char *buf, size_t len)
+{
+	ssize_t n, total;
+
+	for (total = 0; total < len; total += n) {
+		n = read(fd, buf + total, len - total);
+		if (n < 0 && errno == EINTR) n = 0;
+		else if (n < 0) return -1;
+		else if (n == 0) break;
+	}
+
+	return total;
+}
+
+bool
+dedup_files_equal(const char *a, const char *b, struct copy_ctl *ctl)
+{
+	ssize_t na, nb;
+	char *buf;
+	int fa, fb;
+	bool equal;
+
+	fa = open(a, O_RDONLY | O_CLOEXEC);
+	if (fa < 0) return false;
+
+	fb = open(b, O_RDONLY | O_CLOEXEC);
+	if (fb < 0) {
+		close(fa);
+		return false;
+	}
+
+	buf = malloc(2 * DEDUP_BUFSIZE);
+	if (!buf) ERROR(SYSTEM, "malloc");
+
+	equal = false;
+	while (true) {
+		na = read_full(fa, buf, DEDUP_BUFSIZE);
+		nb = read_full(fb, buf + DEDUP_BUFSIZE, DEDUP_BUFSIZE);
+		if (na < 0 || nb < 0) break;
+		if (na != nb || memcmp(buf, buf + DEDUP_BUFSIZE, na)) {
+			errno = EINVAL;
+			break;
+		}
+		if (!na) {
+			equal = true;
+			break;
+		}
+		if (!copy_ctl_step(ctl, na)) break;
+	}
+
+	free(buf);
+	close(fb);
+	close(fa);
+
+	return equal;
+}
+
+bool
+dedup_hash_file(const char *path, uint64_t *hash, struct copy_ctl *ctl)
+{
+	struct xxh64 state;
+	ssize_t n;
+	char *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	buf = malloc(DEDUP_BUFSIZE);
+	if (!buf) ERROR(SYSTEM, "malloc");
+
+	xxh64_init(&state, 0);
+	while ((n = read(fd, buf, DEDUP_BUFSIZE))) {
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 || !copy_ctl_step(ctl, n)) {
+			free(buf);
+			close(fd);
+			return false;
+		}
+		xxh64_update(&state, buf, n);
+	}
+	*hash = xxh64_digest(&state);
+
+	free(buf);
+	close(fd);
+
+	return true;
+}
+
+bool
+dedup_link_file(const char *src, const char *dst, struct copy_ctl *ctl)
+{
+	char *tmp;
+	int err;
+
+	/* equal hashes only suggest equal content */
+	if (!dedup_files_equal(src, dst, ctl))
+		return false;
+
+	/* replace atomically, dst never goes missing */
+	tmp = aprintf("%s.dedup", dst);
+	unlink(tmp);
+	if (link(src, tmp) != 0) {
+		err = errno;
+		free(tmp);
+		errno = err;
+		return false;
+	}
+
+	if (rename(tmp, dst) != 0) {
+		err = errno;
+		unlink(tmp);
+		free(tmp);
+		errno = err;
+		return false;
+	}
+
+	free(tmp);
+
+	return true;
+}
+
+bool
+dedup_stat_file(const char *path, void *file)
+{
+	struct dedup_file *f = file;
+	struct stat st;
+
+	/* gone or special files are skipped, not errors */
+	if (stat(path, &st) || !S_ISREG(st.st_mode))
+		return true;
+
+	f->dev = st.st_dev;
+	f->ino = st.st_ino;
+	f->size = st.st_size;
+	f->mtime = st.st_mtim;
+	f->found = true;
+
+	return true;
+}
+
+void
+dedup_collect(void)
+{
+	struct link *link;
+	struct track *track;
+
+	/* only paths here, files are looked at by the workers */
+	file_count = list_len(&tracks);
+	files = calloc(MAX(1, file_count), sizeof(struct dedup_file));
+	if (!files) ERROR(SYSTEM, "calloc");
+
+	file_count = 0;
+	for (LIST_ITER(&tracks, link)) {
+		track = UPCAST(link, struct track, link);
+		files[file_count].path = astrdup(track->fpath);
+		files[file_count].id = track->id;
+		file_count += 1;
+	}
+}
+
+void
+dedup_group(void)
+{
+	size_t i, cap;
+
+	/* only files the workers found */
+	for (cap = i = 0; i < file_count; i++) {
+		if (!files[i].found) {
+			free(files[i].path);
+			continue;
+		}
+		files[cap++] = files[i];
+	}
+	file_count = cap;
+
+	/* tracks hard linked to one inode are not duplicates */
+	qsort(files, file_count, sizeof(struct dedup_file), file_ino_cmp);
+	for (cap = i = 0; i < file_count; i++) {
+		if (cap && !file_ino_cmp(&files[cap - 1], &files[i])) {
+			free(files[i].path);
+			continue;
+		}
+		files[cap++] = files[i];
+	}
+	file_count = cap;
+
+	/* only sizes seen more than once need hashing */
+	qsort(files, file_count, sizeof(struct dedup_file), file_size_cmp);
+	for (i = 0; i < file_count; i++) {
+		if (!files[i].size) continue;
+		if (i > 0 && files[i - 1].size == files[i].size)
+			files[i].candidate = true;
+		if (i + 1 < file_count && files[i + 1].size == files[i].size)
+			files[i].candidate = true;
+	}
+}
+
+void
+dedup_cache_load(void)
+{
+	struct dedup_entry entry;
+	unsigned long dev, ino;
+	size_t cap;
+	char *path;
+	FILE *file;
+
+	cache_count = 0;
+
+	path = aprintf("%s/.hashcache", datadir);
+	file = fopen(path, "r");
+	free(path);
+	if (!file) return;
+
+	cap = 0;
+	while (fscanf(file, "%lu %lu %li %li %li %" SCNx64 "\n", &dev, &ino,
+			&entry.size, &entry.mtime.tv_sec,
+			&entry.mtime.tv_nsec, &entry.hash) == 6) {
+		entry.dev = dev;
+		entry.ino = ino;
+		if (cache_count == cap) {
+			cap = MAX(64, cap * 2);
+			cache = realloc(cache, cap * sizeof(struct dedup_entry));
+			if (!cache) ERROR(SYSTEM, "realloc");
+		}
+		cache[cache_count++] = entry;
+	}
+
+	fclose(file);
+
+	qsort(cache, cache_count, sizeof(struct dedup_entry), entry_cmp);
+}
+
+void
+dedup_cache_save(void)
+{
+	struct dedup_entry *entry;
+	struct dedup_file *f;
+	char *path, *tmp;
+	FILE *file;
+	size_t i;
+
+	path = aprintf("%s/.hashcache", datadir);
+	tmp = aprintf("%s/.hashcache.tmp", datadir);
+
+	file = fopen(tmp, "w");
+	if (!file) goto cleanup;
+
+	/* files still around, unhashed ones keep their old entry */
+	for (i = 0; i < file_count; i++) {
+		f = &files[i];
+		if (f->hashed) {
+			fprintf(file, "%lu %lu %li %li %li %016" PRIx64 "\n",
+				(unsigned long) f->dev, (unsigned long) f->ino,
+				f->size, f->mtime.tv_sec, f->mtime.tv_nsec,
+				f->hash);
+		} else if ((entry = cache_find(f))) {
+			fprintf(file, "%lu %lu %li %li %li %016" PRIx64 "\n",
+				(unsigned long) entry->dev,
+				(unsigned long) entry->ino, entry->size,
+				entry->mtime.tv_sec, entry->mtime.tv_nsec,
+				entry->hash);
+		}
+	}
+
+	if (fclose(file) || rename(tmp, path))
+		unlink(tmp);
+
+cleanup:
+	free(path);
+	free(tmp);
+}
+
+void
+dedup_finish(void)
+{
+	struct track *track;
+	struct job *job;
+	uint64_t bytes;
+	size_t i, j, k;
+	int groups, dups;
+
+	qsort(files, file_count, sizeof(struct dedup_file), file_hash_cmp);
+
+	job = NULL;
+	if (link_dups && !dedup_canceled)
+		job = job_create(JOB_LINK, NULL);
+
+	groups = dups = 0;
+	bytes = 0;
+	for (i = 0; i < file_count && files[i].hashed; i = j) {
+		for (j = i + 1; j < file_count && files[j].hashed; j++) {
+			if (files[j].size != files[i].size) break;
+			if (files[j].hash != files[i].hash) break;
+		}
+		if (j - i < 2) continue;
+
+		groups += 1;
+		log_info("DEDUP: %li bytes %016" PRIx64 "\n",
+			files[i].size, files[i].hash);
+		for (k = i; k < j; k++) {
+			log_info("DEDUP:   %s\n", files[k].path);
+			if (k == i) continue;
+
+			/* keep the first, links cannot cross devices */
+			dups += 1;
+			if (files[k].dev != files[i].dev) continue;
+			bytes += files[k].size;
+
+			/* the track may be gone since its path was taken */
+			track = track_find_id(files[k].id);
+			if (job && track)
+				job_add_link(job, files[i].path, track);
+		}
+	}
+
+	dedup_cache_save();
+
+	if (job && job_submit(job)) {
+		USER_STATUS("%i duplicates in %i groups, linking %lu MiB",
+			dups, groups, bytes >> 20);
+	} else {
+		USER_STATUS("%i duplicates in %i groups, %lu MiB reclaimable",
+			dups, groups, bytes >> 20);
+	}
+}
+
+void
+dedup_free(void)
+{
+	size_t i;
+
+	for (i = 0; i < file_count; i++)
+		free(files[i].path);
+	free(files);
+	files = NULL;
+	file_count = 0;
+
+	free(cache);
+	cache = NULL;
+	cache_count = 0;
+}
+
+bool
+dedup_start(bool link)
+{
+	struct job **jobs;
+	size_t i, k;
+	int workers;
+
+	if (dedup_pending) {
+		USER_STATUS("Dedup already running");
+		return false;
+	}
+
+	dedup_free();
+	link_dups = link;
+	dedup_canceled = false;
+
+	dedup_collect();
+
+	/* a slow or remote library must not stall the ui */
+	workers = job_workers();
+	jobs = calloc(workers, sizeof(struct job *));
+	if (!jobs) ERROR(SYSTEM, "calloc");
+
+	for (i = 0; i < file_count; i++) {
+		k = i % workers;
+		if (!jobs[k])
+			jobs[k] = job_create(JOB_STAT, NULL);
+		job_add_path(jobs[k], files[i].path, NULL, &files[i]);
+	}
+
+	for (k = 0; k < workers; k++) {
+		if (jobs[k] && job_submit(jobs[k]))
+			dedup_pending += 1;
+	}
+
+	free(jobs);
+
+	if (!dedup_pending)
+		dedup_hash_start();
+	else
+		USER_STATUS("Scanning %lu files", file_count);
+
+	return true;
+}
+
+void
+dedup_hash_start(void)
+{
+	struct dedup_entry *entry;
+	struct job **jobs;
+	uint64_t *loads;
+	size_t i, k, min;
+	int workers, count;
+
+	dedup_group();
+	dedup_cache_load();
+
+	workers = job_workers();
+	jobs = calloc(workers, sizeof(struct job *));
+	loads = calloc(workers, sizeof(uint64_t));
+	if (!jobs || !loads) ERROR(SYSTEM, "calloc");
+
+	/* largest first onto the least loaded worker */
+	count = 0;
+	for (i = file_count; i-- > 0; ) {
+		if (!files[i].candidate) continue;
+
+		if ((entry = cache_find(&files[i]))) {
+			files[i].hash = entry->hash;
+			files[i].hashed = true;
+			continue;
+		}
+
+		for (min = 0, k = 1; k < workers; k++) {
+			if (loads[k] < loads[min])
+				min = k;
+		}
+		if (!jobs[min])
+			jobs[min] = job_create(JOB_HASH, NULL);
+		job_add_path(jobs[min], files[i].path, NULL, &files[i]);
+		loads[min] += files[i].size;
+		count += 1;
+	}
+
+	for (k = 0; k < workers; k++) {
+		if (jobs[k] && job_submit(jobs[k]))
+			dedup_pending += 1;
+	}
+
+	free(jobs);
+	free(loads);
+
+	if (!dedup_pending)
+		dedup_finish();
+	else
+		USER_STATUS("Hashing %i files", count);
+}
+
+void
+dedup_hashed(void *file, uint64_t hash)
+{
+	struct dedup_file *f = file;
+
+	f->hash = hash;
+	f->hashed = true;
+}
+
+void
+dedup_stat_done(bool canceled)
+{
+	ASSERT(dedup_pending > 0);
+
+	if (canceled)
+		dedup_canceled = true;
+
+	if (--dedup_pending > 0)
+		return;
+
+	if (dedup_canceled)
+		USER_STATUS("Dedup canceled");
+	else
+		dedup_hash_start();
+}
+
+void
+dedup_hash_done(bool canceled)
+{
+	ASSERT(dedup_pending > 0);
+
+	if (canceled)
+		dedup_canceled = true;
+
+	if (--dedup_pending == 0)
+		dedup_finish();
+}
+
+void
+dedup_linked(int count, uint64_t bytes)
+{
+	USER_STATUS("Linked %i duplicates, reclaimed %lu MiB",
+		count, bytes >> 20);
+}
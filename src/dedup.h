@@ -0,0 +1,23 @@
+#pragma once
+
+#include "data.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* finds byte-identical track files by size, then content hash,
+ * and optionally replaces the copies with hard links */
+bool dedup_start(bool link);
+
+/* run by job workers */
+bool dedup_stat_file(const char *path, void *file);
+bool dedup_files_equal(const char *a, const char *b,
+	struct copy_ctl *ctl);
+bool dedup_hash_file(const char *path, uint64_t *hash, struct copy_ctl *ctl);
+bool dedup_link_file(const char *src, const char *dst, struct copy_ctl *ctl);
+
+/* job results, on the main thread */
+void dedup_stat_done(bool canceled);
+void dedup_hashed(void *file, uint64_t hash);
+void dedup_hash_done(bool canceled);
+void dedup_linked(int count, uint64_t bytes);
@@ -0,0 +1,108 @@
+#define _XOPEN_SOURCE
+
+#include "dispstr.h"
+
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void dispstr_build(struct dispstr *disp, const char *str);
+
+void
+dispstr_build(struct dispstr *disp, const char *str)
+{
+	mbstate_t mbs;
+	size_t slen, n;
+	wchar_t wc;
+	int w;
+
+	slen = strlen(str);
+	disp->wstr = malloc((slen + 1) * sizeof(wchar_t));
+	if (!disp->wstr) ERROR(SYSTEM, "malloc");
+
+	disp->len = 0;
+	disp->width = 0;
+
+	memset(&mbs, 0, sizeof(mbs));
+	while (*str) {
+		n = mbrtowc(&wc, str, slen, &mbs);
+		if (n == (size_t) -1 || n == (size_t) -2) {
+			/* show invalid bytes instead of dropping the name */
+			memset(&mbs, 0, sizeof(mbs));
+			wc = L'?';
+			n = 1;
+		}
+
+		w = wcwidth(wc);
+		if (w < 0) {
+			wc = L'?';
+			w = 1;
+		}
+
+		disp->wstr[disp->len++] = wc;
+		disp->width += w;
+		str += n;
+		slen -= n;
+	}
+	disp->wstr[disp->len] = L'\0';
+
+	disp->fit_cols = -1;
+}
+
+void
+dispstr_init(struct dispstr *disp)
+{
+	disp->wstr = NULL;
+	disp->len = 0;
+	disp->width = 0;
+	disp->fit_cols = -1;
+	disp->fit_len = 0;
+	disp->fit_width = 0;
+}
+
+void
+dispstr_clear(struct dispstr *disp)
+{
+	free(disp->wstr);
+	dispstr_init(disp);
+}
+
+int
+dispstr_width(struct dispstr *disp, const char *str)
+{
+	if (!disp->wstr)
+		dispstr_build(disp, str);
+
+	return disp->width;
+}
+
+int
+dispstr_fit(struct dispstr *disp, const char *str, int cols)
+{
+	int i, w, width;
+
+	if (!disp->wstr)
+		dispstr_build(disp, str);
+
+	if (cols == disp->fit_cols)
+		return disp->fit_len;
+
+	if (disp->width <= cols) {
+		i = disp->len;
+		width = disp->width;
+	} else {
+		width = 0;
+		for (i = 0; i < disp->len; i++) {
+			w = MAX(0, wcwidth(disp->wstr[i]));
+			if (width + w > cols) break;
+			width += w;
+		}
+	}
+
+	disp->fit_cols = cols;
+	disp->fit_len = i;
+	disp->fit_width = width;
+
+	return disp->fit_len;
+}
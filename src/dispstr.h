@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <wchar.h>
+
+/* cached wide-char form of a name for drawing,
+ * built lazily and cleared when the name changes */
+struct dispstr {
+	wchar_t *wstr;
+	int len, width;
+
+	/* prefix that fits into the last requested width */
+	int fit_cols, fit_len, fit_width;
+};
+
+void dispstr_init(struct dispstr *disp);
+void dispstr_clear(struct dispstr *disp);
+
+int dispstr_width(struct dispstr *disp, const char *str);
+int dispstr_fit(struct dispstr *disp, const char *str, int cols);
@@ -0,0 +1,168 @@
+#include "hash.h"
+
+#include <string.h>
+
+#define P1 0x9E3779B185EBCA87ULL
+#define P2 0xC2B2AE3D27D4EB4FULL
+#define P3 0x165667B19E3779F9ULL
+#define P4 0x85EBCA77C2B2AE63ULL
+#define P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl(uint64_t x, int r);
+static inline uint64_t read64(const uint8_t *p);
+static inline uint32_t read32(const uint8_t *p);
+static inline uint64_t round64(uint64_t acc, uint64_t input);
+static inline uint64_t merge64(uint64_t acc, uint64_t val);
+
+uint64_t
+rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+uint64_t
+read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	/* little endian hosts only, like the rest of tmus */
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+uint64_t
+round64(uint64_t acc, uint64_t input)
+{
+	acc += input * P2;
+	acc = rotl(acc, 31);
+
+	return acc * P1;
+}
+
+uint64_t
+merge64(uint64_t acc, uint64_t val)
+{
+	acc ^= round64(0, val);
+
+	return acc * P1 + P4;
+}
+
+void
+xxh64_init(struct xxh64 *state, uint64_t seed)
+{
+	state->v[0] = seed + P1 + P2;
+	state->v[1] = seed + P2;
+	state->v[2] = seed;
+	state->v[3] = seed - P1;
+	state->total = 0;
+	state->buflen = 0;
+	state->seed = seed;
+}
+
+void
+xxh64_update(struct xxh64 *state, const void *data, size_t len)
+{
+	const uint8_t *p, *end;
+	size_t fill;
+
+	p = data;
+	end = p + len;
+	state->total += len;
+
+	/* complete a partial stripe first */
+	if (state->buflen) {
+		fill = 32 - state->buflen;
+		if (len < fill) {
+			memcpy(state->buf + state->buflen, p, len);
+			state->buflen += len;
+			return;
+		}
+		memcpy(state->buf + state->buflen, p, fill);
+		state->v[0] = round64(state->v[0], read64(state->buf));
+		state->v[1] = round64(state->v[1], read64(state->buf + 8));
+		state->v[2] = round64(state->v[2], read64(state->buf + 16));
+		state->v[3] = round64(state->v[3], read64(state->buf + 24));
+		p += fill;
+		state->buflen = 0;
+	}
+
+	for (; p + 32 <= end; p += 32) {
+		state->v[0] = round64(state->v[0], read64(p));
+		state->v[1] = round64(state->v[1], read64(p + 8));
+		state->v[2] = round64(state->v[2], read64(p + 16));
+		state->v[3] = round64(state->v[3], read64(p + 24));
+	}
+
+	if (p < end) {
+		memcpy(state->buf, p, end - p);
+		state->buflen = end - p;
+	}
+}
+
+uint64_t
+xxh64_digest(const struct xxh64 *state)
+{
+	const uint8_t *p, *end;
+	uint64_t h;
+
+	if (state->total >= 32) {
+		h = rotl(state->v[0], 1) + rotl(state->v[1], 7)
+			+ rotl(state->v[2], 12) + rotl(state->v[3], 18);
+		h = merge64(h, state->v[0]);
+		h = merge64(h, state->v[1]);
+		h = merge64(h, state->v[2]);
+		h = merge64(h, state->v[3]);
+	} else {
+		h = state->seed + P5;
+	}
+
+	h += state->total;
+
+	p = state->buf;
+	end = p + state->buflen;
+	for (; p + 8 <= end; p += 8) {
+		h ^= round64(0, read64(p));
+		h = rotl(h, 27) * P1 + P4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (uint64_t) read32(p) * P1;
+		h = rotl(h, 23) * P2 + P3;
+		p += 4;
+	}
+
+	for (; p < end; p++) {
+		h ^= *p * P5;
+		h = rotl(h, 11) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+uint64_t
+xxh64(const void *data, size_t len, uint64_t seed)
+{
+	struct xxh64 state;
+
+	xxh64_init(&state, seed);
+	xxh64_update(&state, data, len);
+
+	return xxh64_digest(&state);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* streaming XXH64, fast non-cryptographic content hash */
+struct xxh64 {
+	uint64_t v[4];
+	uint64_t total;
+	uint8_t buf[32];
+	size_t buflen;
+	uint64_t seed;
+};
+
+void xxh64_init(struct xxh64 *state, uint64_t seed);
+void xxh64_update(struct xxh64 *state, const void *data, size_t len);
+uint64_t xxh64_digest(const struct xxh64 *state);
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
@@ -0,0 +1,646 @@
+#include "job.h"
+
+#include "data.h"
+#include "dedup.h"
+#include "list.h"
+#include "log.h"
+#include "player.h"
+#include "tui.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define JOB_THREADS_DEFAULT 2
+#define JOB_THREADS_MAX 16
+
+enum {
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_FAILED,
+	JOB_CANCELED
+};
+
+struct job_item {
+	/* cleared when removed while the job is pending */
+	struct track *track;
+
+	/* owned copies, all a worker looks at */
+	char *name, *src, *dst;
+	uint64_t size;
+
+	/* of dst once written, the track is indexed without a stat */
+	uint64_t dev, ino;
+
+	/* opaque to jobs, passed back with the result */
+	void *data;
+	uint64_t hash;
+
+	bool ok, deleted;
+};
+
+struct job {
+	int type;
+	_Atomic int state;
+	_Atomic int finished;
+	int failed, err;
+
+	/* destination or removed tag */
+	struct tag *tag;
+
+	struct job_item *items;
+	int count, cap;
+
+	/* grows as workers look up item sizes */
+	_Atomic uint64_t size;
+	struct copy_ctl ctl;
+
+	struct link link; /* jobs list */
+	struct link link_q; /* pending list */
+};
+
+static void job_free(struct job *job);
+static struct job_item *job_add_item(struct job *job, const char *name,
+	const char *src);
+static bool job_run_item(struct job *job, struct job_item *item);
+static void job_run(struct job *job);
+static void *job_worker(void *arg);
+static void job_finish(struct job *job);
+static struct track *job_track_add(struct tag *tag, struct job_item *item);
+
+static const char *job_verbs[] = {
+	[JOB_COPY] = "copy",
+	[JOB_MOVE] = "move",
+	[JOB_TRASH] = "trash",
+	[JOB_DELETE] = "delete",
+	[JOB_RMTAG] = "remove",
+	[JOB_STAT] = "scan",
+	[JOB_HASH] = "hash",
+	[JOB_LINK] = "link",
+};
+
+static bool job_active;
+
+/* only touched by the main thread */
+static struct list jobs; /* struct job (link) */
+
+/* totals since the queue was last empty, for the eta */
+static uint64_t batch_start_ms;
+static uint64_t batch_done;
+
+/* shared with the workers */
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static struct list job_pending; /* struct job (link_q) */
+static bool job_quit;
+
+static pthread_t job_threads[JOB_THREADS_MAX];
+static int job_thread_count;
+
+void
+job_free(struct job *job)
+{
+	int i;
+
+	for (i = 0; i < job->count; i++) {
+		free(job->items[i].name);
+		free(job->items[i].src);
+		free(job->items[i].dst);
+	}
+	free(job->items);
+	free(job);
+}
+
+struct job_item *
+job_add_item(struct job *job, const char *name, const char *src)
+{
+	struct job_item *item;
+
+	if (job->count == job->cap) {
+		job->cap = MAX(4, job->cap * 2);
+		job->items = realloc(job->items,
+			job->cap * sizeof(struct job_item));
+		if (!job->items) ERROR(SYSTEM, "realloc");
+	}
+
+	item = &job->items[job->count++];
+	item->track = NULL;
+	item->name = astrdup(name);
+	item->src = astrdup(src);
+	item->dst = NULL;
+	item->data = NULL;
+	item->size = 0;
+	item->dev = 0;
+	item->ino = 0;
+	item->ok = false;
+	item->deleted = false;
+
+	if (job->tag && job->type != JOB_RMTAG)
+		item->dst = aprintf("%s/%s", job->tag->fpath, name);
+
+	return item;
+}
+
+bool
+job_run_item(struct job *job, struct job_item *item)
+{
+	int err;
+
+	switch (job->type) {
+	case JOB_TRASH:
+		/* the same file already in the trash, delete instead,
+		 * a different one by that name keeps the source */
+		if (path_exists(item->dst)) {
+			if (dedup_files_equal(item->src, item->dst, &job->ctl)) {
+				item->deleted = true;
+				return rm_file(item->src);
+			}
+			if (errno != ECANCELED)
+				errno = EEXIST;
+			return false;
+		}
+		/* fallthrough */
+	case JOB_MOVE:
+		/* hard link and unlink on the same filesystem,
+		 * a full copy only across filesystems */
+		if (!dup_file_ctl(item->src, item->dst, &job->ctl))
+			return false;
+		if (!rm_file(item->src)) {
+			err = errno;
+			rm_file(item->dst);
+			errno = err;
+			return false;
+		}
+		return true;
+	case JOB_COPY:
+		return dup_file_ctl(item->src, item->dst, &job->ctl);
+	case JOB_DELETE:
+		item->deleted = true;
+		return rm_file(item->src);
+	case JOB_RMTAG:
+		return rm_dir(item->src, true);
+	case JOB_STAT:
+		return dedup_stat_file(item->src, item->data);
+	case JOB_HASH:
+		return dedup_hash_file(item->src, &item->hash, &job->ctl);
+	case JOB_LINK:
+		return dedup_link_file(item->src, item->dst, &job->ctl);
+	}
+
+	return false;
+}
+
+void
+job_run(struct job *job)
+{
+	struct job_item *item;
+	struct stat st;
+	int i;
+
+	/* a failed item does not stop the others, cancel does */
+	for (i = 0; i < job->count; i++) {
+		if (atomic_load(&job->ctl.cancel)) {
+			job->err = ECANCELED;
+			break;
+		}
+
+		item = &job->items[i];
+
+		/* only data that is read counts towards progress,
+		 * looked up here so queueing never waits on the disk */
+		if (job->type != JOB_DELETE && job->type != JOB_RMTAG
+				&& job->type != JOB_STAT
+				&& !stat(item->src, &st)) {
+			item->size = st.st_size;
+			atomic_fetch_add(&job->size, item->size);
+		}
+
+		item->ok = job_run_item(job, item);
+		if (item->ok && item->dst && !item->deleted
+				&& !stat(item->dst, &st)) {
+			item->dev = st.st_dev;
+			item->ino = st.st_ino;
+		}
+		if (!item->ok) {
+			if (errno == ECANCELED) {
+				job->err = ECANCELED;
+				break;
+			}
+			if (!job->failed++)
+				job->err = errno;
+		}
+
+		atomic_fetch_add(&job->finished, 1);
+	}
+
+	if (job->err == ECANCELED)
+		atomic_store(&job->state, JOB_CANCELED);
+	else if (job->failed)
+		atomic_store(&job->state, JOB_FAILED);
+	else
+		atomic_store(&job->state, JOB_DONE);
+}
+
+void *
+job_worker(void *arg)
+{
+	struct link *link;
+	struct job *job;
+
+	pthread_mutex_lock(&job_lock);
+	while (true) {
+		while (!job_quit && list_empty(&job_pending))
+			pthread_cond_wait(&job_cond, &job_lock);
+		if (job_quit) break;
+
+		link = list_pop_front(&job_pending);
+		job = UPCAST(link, struct job, link_q);
+		atomic_store(&job->state, JOB_RUNNING);
+		pthread_mutex_unlock(&job_lock);
+
+		job_run(job);
+
+		pthread_mutex_lock(&job_lock);
+	}
+	pthread_mutex_unlock(&job_lock);
+
+	return NULL;
+}
+
+void
+job_finish(struct job *job)
+{
+	struct job_item *item;
+	struct track *new;
+	uint64_t bytes, id;
+	int i, linked;
+
+	if (atomic_load(&job->state) == JOB_FAILED) {
+		if (job->failed > 1) {
+			USER_STATUS("Failed to %s %i tracks: %s",
+				job_verbs[job->type], job->failed,
+				strerror(job->err));
+		} else {
+			USER_STATUS("Failed to %s %s", job_verbs[job->type],
+				strerror(job->err));
+		}
+	}
+
+	/* items done before a failure or cancel still apply */
+	linked = 0;
+	bytes = 0;
+	for (i = 0; i < job->count; i++) {
+		item = &job->items[i];
+		if (!item->ok) {
+			if (item->src && job->err)
+				log_info("JOB: %s %s failed\n",
+					job_verbs[job->type], item->src);
+			continue;
+		}
+
+		switch (job->type) {
+		case JOB_COPY:
+			if (job->tag) job_track_add(job->tag, item);
+			break;
+		case JOB_MOVE:
+		case JOB_TRASH:
+		case JOB_DELETE:
+			new = NULL;
+			if (job->tag && !item->deleted)
+				new = job_track_add(job->tag, item);
+			if (item->track) {
+				if (player.track == item->track)
+					player.track = new;
+				id = item->track->id;
+				track_rm(item->track, false);
+				/* a moved track stays the same track */
+				if (new) track_set_id(new, id);
+			}
+			break;
+		case JOB_RMTAG:
+			if (job->tag) {
+				if (link_inuse(&job->tag->link_sel))
+					playlist_outdated = true;
+				tag_rm(job->tag, false);
+			}
+			break;
+		case JOB_HASH:
+			dedup_hashed(item->data, item->hash);
+			break;
+		case JOB_LINK:
+			/* the track now names the kept file */
+			if (item->track) track_set_inode(item->track,
+				item->dev, item->ino);
+			linked += 1;
+			bytes += item->size;
+			break;
+		}
+	}
+
+	if (job->type == JOB_STAT)
+		dedup_stat_done(atomic_load(&job->state) == JOB_CANCELED);
+	else if (job->type == JOB_HASH)
+		dedup_hash_done(atomic_load(&job->state) == JOB_CANCELED);
+	else if (job->type == JOB_LINK)
+		dedup_linked(linked, bytes);
+}
+
+struct track *
+job_track_add(struct tag *tag, struct job_item *item)
+{
+	struct track *track;
+
+	track = track_add_id(tag, item->name, 0);
+	track_set_inode(track, item->dev, item->ino);
+
+	return track;
+}
+
+void
+job_init(void)
+{
+	const char *envstr;
+	int i;
+
+	list_init(&jobs);
+	list_init(&job_pending);
+	job_quit = false;
+
+	envstr = getenv("TMUS_JOB_THREADS");
+	job_thread_count = envstr ? atoi(envstr) : JOB_THREADS_DEFAULT;
+	job_thread_count = MAX(1, MIN(job_thread_count, JOB_THREADS_MAX));
+
+	for (i = 0; i < job_thread_count; i++) {
+		if (pthread_create(&job_threads[i], NULL, job_worker, NULL))
+			ERROR(SYSTEM, "pthread_create");
+	}
+
+	job_active = true;
+}
+
+void
+job_deinit(void)
+{
+	int i;
+
+	if (!job_active) return;
+
+	/* running copies stop early and leave their source */
+	job_cancel();
+
+	pthread_mutex_lock(&job_lock);
+	job_quit = true;
+	pthread_cond_broadcast(&job_cond);
+	pthread_mutex_unlock(&job_lock);
+
+	for (i = 0; i < job_thread_count; i++)
+		pthread_join(job_threads[i], NULL);
+
+	/* apply what completed before the cancel */
+	job_update();
+	ASSERT(list_empty(&jobs));
+
+	job_active = false;
+}
+
+void
+job_update(void)
+{
+	struct link *link, *next;
+	struct job *job;
+	int state;
+
+	if (!job_active) return;
+
+	link = jobs.head.next;
+	while (LIST_INNER(link)) {
+		next = link->next;
+
+		job = UPCAST(link, struct job, link);
+		state = atomic_load(&job->state);
+		if (state != JOB_QUEUED && state != JOB_RUNNING) {
+			job_finish(job);
+			batch_done += atomic_load(&job->size);
+			link_pop(&job->link);
+			job_free(job);
+			tui_damage(DAMAGE_CMD);
+		}
+
+		link = next;
+	}
+}
+
+struct job *
+job_create(int type, struct tag *tag)
+{
+	struct job *job;
+
+	job = malloc(sizeof(struct job));
+	if (!job) ERROR(SYSTEM, "malloc");
+
+	job->type = type;
+	atomic_store(&job->state, JOB_QUEUED);
+	atomic_store(&job->finished, 0);
+	job->failed = 0;
+	job->err = 0;
+
+	job->tag = tag;
+
+	job->items = NULL;
+	job->count = 0;
+	job->cap = 0;
+
+	atomic_store(&job->size, 0);
+	atomic_store(&job->ctl.done, 0);
+	atomic_store(&job->ctl.cancel, false);
+
+	job->link = LINK_EMPTY;
+	job->link_q = LINK_EMPTY;
+
+	return job;
+}
+
+void
+job_add_track(struct job *job, struct track *track)
+{
+	struct job_item *item;
+
+	item = job_add_item(job, track->name, track->fpath);
+	item->track = track;
+}
+
+void
+job_add_path(struct job *job, const char *src, const char *dst, void *data)
+{
+	struct job_item *item;
+	const char *name;
+
+	name = strrchr(src, '/');
+	item = job_add_item(job, name ? name + 1 : src, src);
+	if (dst) {
+		free(item->dst);
+		item->dst = astrdup(dst);
+	}
+	item->data = data;
+}
+
+void
+job_add_link(struct job *job, const char *src, struct track *track)
+{
+	struct job_item *item;
+
+	/* the track's file is replaced by a link to src */
+	item = job_add_item(job, track->name, src);
+	item->dst = astrdup(track->fpath);
+	item->track = track;
+}
+
+int
+job_submit(struct job *job)
+{
+	int count;
+
+	/* nothing starts while shutting down */
+	count = job->count;
+	if (!count || job_quit) {
+		job_free(job);
+		return 0;
+	}
+
+	if (list_empty(&jobs)) {
+		batch_start_ms = current_ms();
+		batch_done = 0;
+	}
+
+	list_push_back(&jobs, &job->link);
+
+	pthread_mutex_lock(&job_lock);
+	list_push_back(&job_pending, &job->link_q);
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_lock);
+
+	return count;
+}
+
+void
+job_rm_tag(struct tag *tag)
+{
+	struct job *job;
+
+	job = job_create(JOB_RMTAG, tag);
+	job_add_item(job, tag->name, tag->fpath);
+	job_submit(job);
+}
+
+int
+job_cancel(void)
+{
+	struct link *link;
+	struct job *job;
+	int count;
+
+	if (!job_active) return 0;
+
+	count = 0;
+
+	pthread_mutex_lock(&job_lock);
+
+	/* queued jobs never start */
+	while (!list_empty(&job_pending)) {
+		link = list_pop_front(&job_pending);
+		job = UPCAST(link, struct job, link_q);
+		job->err = ECANCELED;
+		atomic_store(&job->state, JOB_CANCELED);
+		count += job->count;
+	}
+
+	/* running ones check the flag between items and chunks */
+	for (LIST_ITER(&jobs, link)) {
+		job = UPCAST(link, struct job, link);
+		if (atomic_load(&job->state) == JOB_RUNNING) {
+			atomic_store(&job->ctl.cancel, true);
+			count += job->count - atomic_load(&job->finished);
+		}
+	}
+
+	pthread_mutex_unlock(&job_lock);
+
+	return count;
+}
+
+void
+job_forget_track(struct track *track)
+{
+	struct link *link;
+	struct job *job;
+	int i;
+
+	if (!job_active) return;
+
+	for (LIST_ITER(&jobs, link)) {
+		job = UPCAST(link, struct job, link);
+		for (i = 0; i < job->count; i++) {
+			if (job->items[i].track == track)
+				job->items[i].track = NULL;
+		}
+	}
+}
+
+void
+job_forget_tag(struct tag *tag)
+{
+	struct link *link;
+	struct job *job;
+
+	if (!job_active) return;
+
+	for (LIST_ITER(&jobs, link)) {
+		job = UPCAST(link, struct job, link);
+		if (job->tag == tag)
+			job->tag = NULL;
+	}
+}
+
+int
+job_workers(void)
+{
+	return job_thread_count;
+}
+
+bool
+job_progress(struct job_progress *progress)
+{
+	struct link *link;
+	struct job *job;
+	uint64_t elapsed, size;
+
+	if (!job_active || list_empty(&jobs))
+		return false;
+
+	progress->left = 0;
+	progress->size = batch_done;
+	progress->done = batch_done;
+	for (LIST_ITER(&jobs, link)) {
+		job = UPCAST(link, struct job, link);
+		size = atomic_load(&job->size);
+		progress->size += size;
+		progress->done += MIN(atomic_load(&job->ctl.done), size);
+		progress->left += job->count - atomic_load(&job->finished);
+	}
+
+	/* extrapolate from the rate since the batch started */
+	elapsed = current_ms() - batch_start_ms;
+	if (progress->done && elapsed >= 1000) {
+		progress->eta = elapsed * (progress->size - progress->done)
+			/ progress->done / 1000;
+	} else {
+		progress->eta = -1;
+	}
+
+	return true;
+}
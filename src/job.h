@@ -0,0 +1,49 @@
+#pragma once
+
+#include "data.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* file operations run by worker threads, tracks and tags
+ * are only updated on the main thread in job_update */
+
+enum {
+	JOB_COPY,
+	JOB_MOVE,
+	JOB_TRASH,
+	JOB_DELETE,
+	JOB_RMTAG,
+	JOB_STAT,
+	JOB_HASH,
+	JOB_LINK
+};
+
+struct job_progress {
+	int left;
+	uint64_t size, done;
+	int eta; /* seconds, -1 if unknown */
+};
+
+struct job;
+
+void job_init(void);
+void job_deinit(void);
+void job_update(void);
+
+/* a job covers any number of tracks and is applied at once */
+struct job *job_create(int type, struct tag *tag);
+void job_add_track(struct job *job, struct track *track);
+void job_add_path(struct job *job, const char *src, const char *dst,
+	void *data);
+void job_add_link(struct job *job, const char *src, struct track *track);
+int job_submit(struct job *job);
+
+void job_rm_tag(struct tag *tag);
+int job_cancel(void);
+
+void job_forget_track(struct track *track);
+void job_forget_tag(struct tag *tag);
+
+int job_workers(void);
+bool job_progress(struct job_progress *progress);
@@ -0,0 +1,533 @@
+#include "journal.h"
+
+#include "data.h"
+#include "list.h"
+#include "log.h"
+#include "util.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* journal size at which it is folded into the index files */
+#define JOURNAL_ROTATE (1 << 20)
+
+/* one journal record, tag and name point into line */
+struct journal_op {
+	char *line;
+	const char *tag, *name; /* name is NULL for resets */
+	uint64_t id; /* adds only, 0 if missing */
+	size_t seq;
+	char type;
+};
+
+/* index and .ids contents captured on the main thread for the compactor */
+struct index_snap {
+	char *path, *ids_path;
+	char *buf, *ids;
+	size_t len, ids_len;
+	struct link link;
+};
+
+static bool journal_read(const char *path, struct journal_op **ops,
+	size_t *count, size_t *cap);
+static void journal_replay_tag(struct journal_op *ops, size_t count);
+static int op_order_cmp(const void *p1, const void *p2);
+static int op_name_cmp(const void *p1, const void *p2);
+static int op_name_seq_cmp(const void *p1, const void *p2);
+static int op_seq_cmp(const void *p1, const void *p2);
+
+static void journal_write(char type, const char *tag,
+	const char *name, uint64_t id);
+static void journal_rotate(void);
+static void journal_reap(void);
+static void journal_compacted(void);
+static struct index_snap *index_snap(struct tag *tag);
+static bool index_write(const char *path, const char *buf, size_t len);
+static void *compact_run(void *arg);
+
+static FILE *journal;
+static char *journal_path, *journal_old_path;
+static size_t journal_size;
+static bool journal_pending;
+
+static pthread_t compact_thread;
+static struct list compact_snaps; /* struct index_snap (link) */
+static bool compact_running;
+static bool compact_failed;
+static _Atomic bool compact_done;
+static _Atomic bool compact_ok;
+
+bool
+journal_read(const char *path, struct journal_op **ops,
+	size_t *count, size_t *cap)
+{
+	char linebuf[1024];
+	struct journal_op *op;
+	char *sep;
+	FILE *file;
+	size_t len;
+
+	file = fopen(path, "r");
+	if (!file) return false;
+
+	while (fgets(linebuf, sizeof(linebuf), file)) {
+		len = strlen(linebuf);
+		/* a record cut short by a crash is dropped */
+		if (len < 4 || linebuf[len - 1] != '\n' || linebuf[1] != ' ')
+			continue;
+		linebuf[len - 1] = '\0';
+
+		if (*count == *cap) {
+			*cap = *cap ? *cap * 2 : 256;
+			*ops = realloc(*ops, *cap * sizeof(struct journal_op));
+			if (!*ops) ERROR(SYSTEM, "realloc");
+		}
+
+		op = &(*ops)[*count];
+		op->type = linebuf[0];
+		op->line = astrdup(linebuf + 2);
+		op->tag = op->line;
+		op->name = NULL;
+		op->id = 0;
+		op->seq = *count;
+
+		/* adds carry the track id in front */
+		if (op->type == 'A' && strlen(op->line) > 17
+				&& op->line[16] == ' ') {
+			op->id = strtoull(op->line, &sep, 16);
+			if (sep == op->line + 16)
+				op->tag = op->line + 17;
+			else
+				op->id = 0;
+		}
+
+		sep = strchr(op->tag, '/');
+		if (sep) {
+			*sep = '\0';
+			op->name = sep + 1;
+		}
+
+		if (!strchr("ARX", op->type) || !op->type
+				|| (op->type == 'X') != !op->name) {
+			free(op->line);
+			continue;
+		}
+
+		*count += 1;
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+int
+op_order_cmp(const void *p1, const void *p2)
+{
+	const struct journal_op *op1 = p1, *op2 = p2;
+	int cmp;
+
+	cmp = strcmp(op1->tag, op2->tag);
+	if (cmp) return cmp;
+
+	return op1->seq < op2->seq ? -1 : op1->seq > op2->seq;
+}
+
+int
+op_name_cmp(const void *p1, const void *p2)
+{
+	const struct journal_op *op1 = p1, *op2 = p2;
+
+	return strcmp(op1->name, op2->name);
+}
+
+int
+op_name_seq_cmp(const void *p1, const void *p2)
+{
+	const struct journal_op *op1 = p1, *op2 = p2;
+	int cmp;
+
+	cmp = strcmp(op1->name, op2->name);
+	if (cmp) return cmp;
+
+	return op1->seq < op2->seq ? -1 : op1->seq > op2->seq;
+}
+
+int
+op_seq_cmp(const void *p1, const void *p2)
+{
+	const struct journal_op *op1 = p1, *op2 = p2;
+
+	return op1->seq < op2->seq ? -1 : op1->seq > op2->seq;
+}
+
+void
+journal_replay_tag(struct journal_op *ops, size_t count)
+{
+	struct journal_op key, *op;
+	struct track *track;
+	struct link *link;
+	struct tag *tag;
+	size_t i, k;
+
+	/* only records after the last index write count */
+	for (i = count; i > 0 && ops[i-1].name; i--)
+		;
+	for (k = 0; k < i; k++)
+		free(ops[k].line);
+	ops += i;
+	count -= i;
+	if (!count) return;
+
+	tag = tag_find(ops[0].tag);
+	if (!tag) goto cleanup;
+
+	/* the last record per track decides, applied in one pass */
+	qsort(ops, count, sizeof(struct journal_op), op_name_seq_cmp);
+	for (i = k = 0; i < count; i++) {
+		if (i + 1 < count && !strcmp(ops[i].name, ops[i+1].name)) {
+			free(ops[i].line);
+			continue;
+		}
+		ops[k++] = ops[i];
+	}
+	count = k;
+
+	link = tag->tracks.list.head.next;
+	while (LIST_INNER(link)) {
+		track = UPCAST(link, struct track, link_tt.link);
+		link = link->next;
+
+		key.name = track->name;
+		op = bsearch(&key, ops, count,
+			sizeof(struct journal_op), op_name_cmp);
+		if (!op) continue;
+
+		if (op->type == 'R') {
+			track_rm(track, false);
+		} else {
+			track_set_id(track, op->id);
+			op->type = 0;
+		}
+	}
+
+	/* added tracks keep the order they were added in */
+	qsort(ops, count, sizeof(struct journal_op), op_seq_cmp);
+	for (i = 0; i < count; i++) {
+		if (ops[i].type != 'A') continue;
+		track = track_add_id(tag, ops[i].name, ops[i].id);
+		track_stat_inode(track);
+	}
+
+cleanup:
+	for (i = 0; i < count; i++)
+		free(ops[i].line);
+}
+
+void
+journal_replay(void)
+{
+	struct journal_op *ops;
+	size_t count, cap, start, end;
+	struct link *link;
+	struct tag *tag;
+
+	journal_path = aprintf("%s/.journal", datadir);
+	journal_old_path = aprintf("%s/.journal.old", datadir);
+
+	/* the old journal is left when compaction did not finish */
+	ops = NULL;
+	count = cap = 0;
+	journal_read(journal_old_path, &ops, &count, &cap);
+	journal_read(journal_path, &ops, &count, &cap);
+	if (!count) {
+		free(ops);
+		return;
+	}
+
+	log_info("JOURNAL: replaying %lu records\n", count);
+
+	qsort(ops, count, sizeof(struct journal_op), op_order_cmp);
+	for (start = 0; start < count; start = end) {
+		end = start + 1;
+		while (end < count && !strcmp(ops[start].tag, ops[end].tag))
+			end++;
+		journal_replay_tag(ops + start, end - start);
+	}
+	free(ops);
+
+	/* start over with an empty journal */
+	for (LIST_ITER(&tags.list, link)) {
+		tag = UPCAST(link, struct tag, link.link);
+		if (tag->index_dirty)
+			tag_save_tracks(tag);
+	}
+
+	unlink(journal_old_path);
+	unlink(journal_path);
+}
+
+void
+journal_open(void)
+{
+	journal = fopen(journal_path, "a");
+	if (!journal) {
+		WARN(SYSTEM, "Failed to open journal: %s", journal_path);
+		return;
+	}
+
+	journal_size = ftell(journal);
+	journal_pending = false;
+
+	list_init(&compact_snaps);
+	compact_running = false;
+	compact_failed = false;
+}
+
+void
+journal_close(void)
+{
+	journal_wait();
+
+	if (journal) {
+		fclose(journal);
+		journal = NULL;
+	}
+
+	/* every index file was just written */
+	unlink(journal_old_path);
+	unlink(journal_path);
+
+	free(journal_path);
+	journal_path = NULL;
+	free(journal_old_path);
+	journal_old_path = NULL;
+}
+
+void
+journal_update(void)
+{
+	if (!journal) return;
+
+	/* one sync for everything recorded since the last frame */
+	if (journal_pending) {
+		if (fflush(journal) || fdatasync(fileno(journal)))
+			WARN(SYSTEM, "Failed to sync journal");
+		journal_pending = false;
+	}
+
+	if (compact_running && atomic_load(&compact_done))
+		journal_reap();
+
+	if (!compact_running && !compact_failed
+			&& journal_size >= JOURNAL_ROTATE)
+		journal_rotate();
+}
+
+void
+journal_wait(void)
+{
+	if (!compact_running) return;
+
+	journal_reap();
+}
+
+void
+journal_track_add(struct track *track)
+{
+	journal_write('A', track->tag->name, track->name, track->id);
+}
+
+void
+journal_track_rm(struct track *track)
+{
+	journal_write('R', track->tag->name, track->name, 0);
+}
+
+void
+journal_tag_reset(struct tag *tag)
+{
+	journal_write('X', tag->name, NULL, 0);
+}
+
+void
+journal_write(char type, const char *tag, const char *name, uint64_t id)
+{
+	int len;
+
+	if (!journal) return;
+
+	if (id)
+		len = fprintf(journal, "%c %016" PRIx64 " %s/%s\n",
+			type, id, tag, name);
+	else if (name)
+		len = fprintf(journal, "%c %s/%s\n", type, tag, name);
+	else
+		len = fprintf(journal, "%c %s\n", type, tag);
+
+	if (len > 0) journal_size += len;
+	journal_pending = true;
+}
+
+void
+journal_rotate(void)
+{
+	struct index_snap *snap;
+	struct link *link;
+	struct tag *tag;
+
+	/* records so far are all covered by the snapshots taken below */
+	fclose(journal);
+	if (rename(journal_path, journal_old_path))
+		WARN(SYSTEM, "Failed to rotate journal");
+
+	journal = fopen(journal_path, "a");
+	if (!journal) {
+		WARN(SYSTEM, "Failed to open journal: %s", journal_path);
+		return;
+	}
+	journal_size = 0;
+
+	for (LIST_ITER(&tags.list, link)) {
+		tag = UPCAST(link, struct tag, link.link);
+		if (!tag->index_dirty) continue;
+		snap = index_snap(tag);
+		list_push_back(&compact_snaps, &snap->link);
+		tag->index_dirty = false;
+	}
+
+	atomic_store(&compact_done, false);
+	atomic_store(&compact_ok, true);
+	compact_running = true;
+	if (pthread_create(&compact_thread, NULL, compact_run, NULL)) {
+		/* no thread, write them right away */
+		compact_run(NULL);
+		compact_running = false;
+		journal_compacted();
+	}
+}
+
+void
+journal_reap(void)
+{
+	pthread_join(compact_thread, NULL);
+	compact_running = false;
+
+	journal_compacted();
+}
+
+void
+journal_compacted(void)
+{
+	struct link *link;
+	struct tag *tag;
+
+	if (atomic_load(&compact_ok)) {
+		unlink(journal_old_path);
+		return;
+	}
+
+	/* keep the old journal for replay and write all indexes on exit */
+	WARNX(SYSTEM, "Failed to compact journal, keeping %s",
+		journal_old_path);
+	for (LIST_ITER(&tags.list, link)) {
+		tag = UPCAST(link, struct tag, link.link);
+		tag->index_dirty = true;
+	}
+	compact_failed = true;
+}
+
+struct index_snap *
+index_snap(struct tag *tag)
+{
+	struct index_snap *snap;
+	struct track *track;
+	struct link *link;
+	size_t len, ids_len;
+
+	snap = malloc(sizeof(struct index_snap));
+	if (!snap) ERROR(SYSTEM, "malloc");
+
+	snap->path = aprintf("%s/index", tag->fpath);
+	snap->ids_path = aprintf("%s/.ids", tag->fpath);
+	snap->len = 0;
+	for (LIST_ITER(&tag->tracks.list, link)) {
+		track = UPCAST(link, struct track, link_tt.link);
+		snap->len += strlen(track->name) + 1;
+	}
+
+	/* each .ids line is the index line behind a hex id */
+	snap->ids_len = snap->len + 17 * olist_len(&tag->tracks);
+	snap->buf = malloc(snap->len + 1);
+	snap->ids = malloc(snap->ids_len + 1);
+	if (!snap->buf || !snap->ids) ERROR(SYSTEM, "malloc");
+
+	len = ids_len = 0;
+	for (LIST_ITER(&tag->tracks.list, link)) {
+		track = UPCAST(link, struct track, link_tt.link);
+		len += sprintf(snap->buf + len, "%s\n", track->name);
+		ids_len += sprintf(snap->ids + ids_len, "%016" PRIx64 " %s\n",
+			track->id, track->name);
+	}
+	snap->link = LINK_EMPTY;
+
+	return snap;
+}
+
+bool
+index_write(const char *path, const char *buf, size_t len)
+{
+	char *tmp;
+	FILE *file;
+	bool ok;
+
+	/* no extension, a reindex does not take it for a track */
+	tmp = aprintf("%s-tmp", path);
+
+	file = fopen(tmp, "w");
+	if (!file) {
+		free(tmp);
+		return false;
+	}
+
+	ok = fwrite(buf, 1, len, file) == len;
+	ok = !fflush(file) && ok;
+	ok = !fdatasync(fileno(file)) && ok;
+	ok = !fclose(file) && ok;
+	ok = ok && !rename(tmp, path);
+	if (!ok) unlink(tmp);
+
+	free(tmp);
+
+	return ok;
+}
+
+void *
+compact_run(void *arg)
+{
+	struct index_snap *snap;
+	struct link *link;
+
+	while (!list_empty(&compact_snaps)) {
+		link = list_pop_front(&compact_snaps);
+		snap = UPCAST(link, struct index_snap, link);
+		if (!index_write(snap->path, snap->buf, snap->len)
+				|| !index_write(snap->ids_path,
+					snap->ids, snap->ids_len))
+			atomic_store(&compact_ok, false);
+		free(snap->path);
+		free(snap->ids_path);
+		free(snap->buf);
+		free(snap->ids);
+		free(snap);
+	}
+
+	atomic_store(&compact_done, true);
+
+	return NULL;
+}
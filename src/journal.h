@@ -0,0 +1,20 @@
+#pragma once
+
+struct tag;
+struct track;
+
+/* track list changes are appended to datadir/.journal as they
+ * happen and folded into the tag index files in the background */
+void journal_replay(void);
+void journal_open(void);
+void journal_close(void);
+void journal_update(void);
+
+/* waits for index files still being written in the background */
+void journal_wait(void);
+
+void journal_track_add(struct track *track);
+void journal_track_rm(struct track *track);
+
+/* the index file of the tag is current, earlier records are void */
+void journal_tag_reset(struct tag *tag);
@@ -1,7 +1,11 @@
 #include "data.h"
+#include "job.h"
+#include "journal.h"
 #include "log.h"
+#include "meta.h"
 #include "mpris.h"
 #include "player.h"
+#include "session.h"
 #include "tui.h"
 
 #include <curses.h>
@@ -31,26 +35,48 @@ init(void)
 
 	data_load();
 
+	/* recordings are replayed on the virtual clock */
+	if (getenv("TMUS_REPLAY")) {
+		setenv("TMUS_PLAYER", "sim", 1);
+		setenv("TMUS_SIM_SPEED", "0", 1);
+	}
+
 	player_init();
 
+	job_init();
+
+	meta_init();
+
 	tui_init();
 
 	dbus_init();
 
+	session_load();
+
 	on_exit(cleanup, NULL);
 	signal(SIGINT, stop);
 	signal(SIGTERM, exit);
 }
 
+/* only state that outlives the process is handled unless
+ * built with LEAKCHECK, freeing the library can take seconds */
 void
 cleanup(int exitcode, void* arg)
 {
 	tui_restore();
 
+	session_save();
+
 	player_deinit();
 
+	job_deinit();
+
+	meta_deinit();
+
 	data_save();
+#ifdef LEAKCHECK
 	data_free();
+#endif
 
 	dbus_deinit();
 
@@ -67,6 +93,10 @@ main(int argc, const char **argv)
 	do {
 		dbus_update();
 		player_update();
+		job_update();
+		meta_update();
+		journal_update();
+		session_update();
 	} while (tui_update());
 }
 
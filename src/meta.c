@@ -0,0 +1,1410 @@
+#include "meta.h"
+
+#include "data.h"
+#include "list.h"
+#include "log.h"
+#include "tui.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define META_THREADS_DEFAULT 2
+#define META_THREADS_MAX 8
+
+/* scanned tracks kept in memory, least recently shown go first */
+#define META_LRU_DEFAULT 65536
+#define META_LRU_MIN 1024
+
+/* scans handed to the workers at a time */
+#define META_INFLIGHT 4096
+
+/* largest tag block read into memory, cover art is skipped */
+#define META_TAG_MAX (1 << 20)
+#define META_TEXT_MAX 4096
+#define META_PROBE 4096
+#define META_MP4_DEPTH 8
+
+#define META_CACHE_MAGIC "TMUSMETA"
+#define META_CACHE_VERSION 1
+
+enum {
+	TEXT_LATIN1,
+	TEXT_UTF16,
+	TEXT_UTF16BE,
+	TEXT_UTF8
+};
+
+struct meta_file {
+	int fd;
+	uint64_t size;
+};
+
+/* a tag read from the file or from memory */
+struct meta_src {
+	struct meta_file *file;
+	const uint8_t *buf;
+	uint64_t base, len;
+};
+
+/* results from earlier runs, strings point into cache_blob */
+struct meta_entry {
+	uint64_t dev, ino;
+	struct timespec mtime;
+	uint64_t size;
+	uint32_t duration;
+	const char *artist, *title;
+};
+
+static inline uint32_t be16(const uint8_t *p);
+static inline uint32_t be24(const uint8_t *p);
+static inline uint32_t be32(const uint8_t *p);
+static inline uint64_t be64(const uint8_t *p);
+static inline uint32_t le16(const uint8_t *p);
+static inline uint32_t le32(const uint8_t *p);
+static inline uint64_t le64(const uint8_t *p);
+static inline uint32_t syncsafe(const uint8_t *p);
+static inline void put16(uint8_t *p, uint16_t v);
+static inline void put32(uint8_t *p, uint32_t v);
+static inline void put64(uint8_t *p, uint64_t v);
+
+static char *meta_text(const uint8_t *p, size_t len, int enc);
+static void meta_set(char **field, char *str);
+
+static bool file_read(struct meta_file *file, uint64_t off,
+	void *buf, size_t len);
+static uint8_t *file_alloc(struct meta_file *file, uint64_t off, size_t len);
+static bool src_read(struct meta_src *src, uint64_t off,
+	void *buf, size_t len);
+
+static void vorbis_comments(const uint8_t *p, uint64_t len, struct meta *meta);
+static void id3_frame(struct meta_src *src, uint64_t pos, uint64_t size,
+	const uint8_t *fh, int ver, struct meta *meta);
+static bool id3_parse(struct meta_file *file, struct meta *meta,
+	uint64_t *audio);
+static bool id3v1_parse(struct meta_file *file, struct meta *meta);
+static void mpeg_duration(struct meta_file *file, uint64_t audio,
+	uint64_t tail, bool strict, struct meta *meta);
+static void flac_parse(struct meta_file *file, uint64_t pos,
+	struct meta *meta);
+static void ogg_parse(struct meta_file *file, struct meta *meta);
+static void mp4_text(struct meta_file *file, uint64_t pos, uint64_t end,
+	char **field);
+static void mp4_walk(struct meta_file *file, uint64_t pos, uint64_t end,
+	int depth, bool ilst, struct meta *meta);
+static void wav_parse(struct meta_file *file, struct meta *meta);
+static void meta_parse(const char *path, struct meta *meta);
+
+static int entry_cmp(const void *a, const void *b);
+static struct meta_entry *cache_find(struct meta *meta);
+static void cache_load(void);
+static void cache_write(FILE *file, const struct meta_entry *entry);
+static void cache_save(void);
+static void cache_free(void);
+
+static struct track *next_track(struct track *track);
+static struct meta *meta_alloc(struct track *track);
+static void meta_free(struct meta *meta);
+static void meta_evict(void);
+static bool meta_scan(struct meta *meta);
+static void *meta_worker(void *arg);
+static int meta_collect(void);
+
+static bool meta_active;
+
+/* only touched by the main thread */
+static struct track *scan_next;
+static int inflight;
+static struct list meta_lru; /* struct meta (link) */
+static size_t meta_resident, meta_lru_max;
+static size_t meta_evicted;
+
+/* read-only while workers run */
+static struct meta_entry *cache;
+static size_t cache_count;
+static char *cache_blob;
+static size_t cache_loaded;
+
+/* shared with the workers */
+static pthread_mutex_t meta_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t meta_cond = PTHREAD_COND_INITIALIZER;
+static struct list meta_todo; /* struct meta (link) */
+static struct list meta_done; /* struct meta (link) */
+static int meta_parsed;
+static bool meta_quit;
+
+static pthread_t meta_threads[META_THREADS_MAX];
+static int meta_thread_count;
+
+uint32_t
+be16(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 8 | p[1];
+}
+
+uint32_t
+be24(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 16 | (uint32_t) p[1] << 8 | p[2];
+}
+
+uint32_t
+be32(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 24 | be24(p + 1);
+}
+
+uint64_t
+be64(const uint8_t *p)
+{
+	return (uint64_t) be32(p) << 32 | be32(p + 4);
+}
+
+uint32_t
+le16(const uint8_t *p)
+{
+	return p[0] | (uint32_t) p[1] << 8;
+}
+
+uint32_t
+le32(const uint8_t *p)
+{
+	return le16(p) | (uint32_t) le16(p + 2) << 16;
+}
+
+uint64_t
+le64(const uint8_t *p)
+{
+	return le32(p) | (uint64_t) le32(p + 4) << 32;
+}
+
+uint32_t
+syncsafe(const uint8_t *p)
+{
+	return (uint32_t) (p[0] & 0x7f) << 21 | (uint32_t) (p[1] & 0x7f) << 14
+		| (uint32_t) (p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+void
+put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+void
+put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+void
+put64(uint8_t *p, uint64_t v)
+{
+	put32(p, v);
+	put32(p + 4, v >> 32);
+}
+
+char *
+meta_text(const uint8_t *p, size_t len, int enc)
+{
+	char *str, *out;
+	uint32_t c, c2;
+	bool be;
+	size_t i;
+
+	if (len > META_TEXT_MAX) len = META_TEXT_MAX;
+
+	/* latin1 doubles at most, utf-16 grows by half */
+	str = out = malloc(2 * len + 1);
+	if (!str) ERROR(SYSTEM, "malloc");
+
+	be = enc == TEXT_UTF16BE;
+	if (enc == TEXT_UTF16 && len >= 2) {
+		if (p[0] == 0xfe && p[1] == 0xff) {
+			be = true;
+			p += 2;
+			len -= 2;
+		} else if (p[0] == 0xff && p[1] == 0xfe) {
+			p += 2;
+			len -= 2;
+		}
+	}
+
+	for (i = 0; i < len; ) {
+		if (enc == TEXT_UTF8) {
+			if (!p[i]) break;
+			*out++ = p[i] < 0x20 ? ' ' : p[i];
+			i += 1;
+			continue;
+		}
+
+		if (enc == TEXT_LATIN1) {
+			c = p[i++];
+		} else {
+			if (i + 2 > len) break;
+			c = be ? be16(p + i) : le16(p + i);
+			i += 2;
+			if (c >= 0xd800 && c < 0xdc00 && i + 2 <= len) {
+				c2 = be ? be16(p + i) : le16(p + i);
+				if (c2 >= 0xdc00 && c2 < 0xe000) {
+					c = 0x10000 + ((c - 0xd800) << 10)
+						+ (c2 - 0xdc00);
+					i += 2;
+				}
+			}
+		}
+
+		if (!c) break;
+		if (c < 0x20) c = ' ';
+
+		if (c < 0x80) {
+			*out++ = c;
+		} else if (c < 0x800) {
+			*out++ = 0xc0 | c >> 6;
+			*out++ = 0x80 | (c & 0x3f);
+		} else if (c < 0x10000) {
+			*out++ = 0xe0 | c >> 12;
+			*out++ = 0x80 | (c >> 6 & 0x3f);
+			*out++ = 0x80 | (c & 0x3f);
+		} else {
+			*out++ = 0xf0 | c >> 18;
+			*out++ = 0x80 | (c >> 12 & 0x3f);
+			*out++ = 0x80 | (c >> 6 & 0x3f);
+			*out++ = 0x80 | (c & 0x3f);
+		}
+	}
+
+	while (out > str && out[-1] == ' ')
+		out--;
+	*out = '\0';
+
+	if (!*str) {
+		free(str);
+		return NULL;
+	}
+
+	return str;
+}
+
+void
+meta_set(char **field, char *str)
+{
+	/* the first tag found wins */
+	if (!*field)
+		*field = str;
+	else
+		free(str);
+}
+
+bool
+file_read(struct meta_file *file, uint64_t off, void *buf, size_t len)
+{
+	size_t total;
+	ssize_t n;
+
+	if (off > file->size || len > file->size - off)
+		return false;
+
+	for (total = 0; total < len; total += n) {
+		n = pread(file->fd, (char *) buf + total,
+			len - total, off + total);
+		if (n < 0 && errno == EINTR) n = 0;
+		else if (n <= 0) return false;
+	}
+
+	return true;
+}
+
+uint8_t *
+file_alloc(struct meta_file *file, uint64_t off, size_t len)
+{
+	uint8_t *buf;
+
+	buf = malloc(MAX(len, 1));
+	if (!buf) ERROR(SYSTEM, "malloc");
+
+	if (!file_read(file, off, buf, len)) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+bool
+src_read(struct meta_src *src, uint64_t off, void *buf, size_t len)
+{
+	if (off > src->len || len > src->len - off)
+		return false;
+
+	if (src->buf) {
+		memcpy(buf, src->buf + off, len);
+		return true;
+	}
+
+	return file_read(src->file, src->base + off, buf, len);
+}
+
+void
+vorbis_comments(const uint8_t *p, uint64_t len, struct meta *meta)
+{
+	uint64_t off, n, count, i;
+	const char *entry;
+
+	/* vendor string, then KEY=value pairs */
+	if (len < 4) return;
+	off = 4 + (uint64_t) le32(p);
+	if (off + 4 > len) return;
+	count = le32(p + off);
+	off += 4;
+
+	for (i = 0; i < count && off + 4 <= len; i++) {
+		n = le32(p + off);
+		off += 4;
+		if (n > len - off) break;
+
+		entry = (const char *) p + off;
+		if (n > 6 && !strncasecmp(entry, "TITLE=", 6)) {
+			meta_set(&meta->title, meta_text(p + off + 6,
+				n - 6, TEXT_UTF8));
+		} else if (n > 7 && !strncasecmp(entry, "ARTIST=", 7)) {
+			meta_set(&meta->artist, meta_text(p + off + 7,
+				n - 7, TEXT_UTF8));
+		}
+		off += n;
+	}
+}
+
+void
+id3_frame(struct meta_src *src, uint64_t pos, uint64_t size,
+	const uint8_t *fh, int ver, struct meta *meta)
+{
+	char **field, *str;
+	uint8_t *data;
+	bool tlen;
+	int skip;
+
+	field = NULL;
+	tlen = false;
+	skip = 0;
+	if (ver == 2) {
+		if (!memcmp(fh, "TT2", 3))
+			field = &meta->title;
+		else if (!memcmp(fh, "TP1", 3))
+			field = &meta->artist;
+		else if (!memcmp(fh, "TLE", 3))
+			tlen = true;
+	} else {
+		if (!memcmp(fh, "TIT2", 4))
+			field = &meta->title;
+		else if (!memcmp(fh, "TPE1", 4))
+			field = &meta->artist;
+		else if (!memcmp(fh, "TLEN", 4))
+			tlen = true;
+
+		/* compressed, encrypted and unsynchronized frames */
+		if (ver == 3 && (fh[9] & 0xc0)) return;
+		if (ver == 4 && (fh[9] & 0x0e)) return;
+
+		/* group id and data length prefixes */
+		if (ver == 3 && (fh[9] & 0x20)) skip += 1;
+		if (ver == 4 && (fh[9] & 0x40)) skip += 1;
+		if (ver == 4 && (fh[9] & 0x01)) skip += 4;
+	}
+
+	if (!field && !tlen) return;
+	if (size < skip + 2 || size - skip > META_TEXT_MAX) return;
+	pos += skip;
+	size -= skip;
+
+	data = malloc(size);
+	if (!data) ERROR(SYSTEM, "malloc");
+	if (!src_read(src, pos, data, size) || data[0] > TEXT_UTF8) {
+		free(data);
+		return;
+	}
+
+	str = meta_text(data + 1, size - 1, data[0]);
+	if (tlen) {
+		if (str && !meta->duration)
+			meta->duration = strtoul(str, NULL, 10);
+		free(str);
+	} else {
+		meta_set(field, str);
+	}
+
+	free(data);
+}
+
+bool
+id3_parse(struct meta_file *file, struct meta *meta, uint64_t *audio)
+{
+	uint8_t hdr[10], fh[10], *data;
+	struct meta_src src;
+	uint64_t pos, size, fsize, i, k, n;
+	int ver, flags, hlen;
+
+	if (!file_read(file, 0, hdr, 10) || memcmp(hdr, "ID3", 3))
+		return false;
+
+	ver = hdr[3];
+	flags = hdr[5];
+	size = syncsafe(hdr + 6);
+	*audio = 10 + size + (ver == 4 && (flags & 0x10) ? 10 : 0);
+	if (ver < 2 || ver > 4) return true;
+
+	src.file = file;
+	src.buf = NULL;
+	src.base = 10;
+	src.len = size;
+
+	/* rare whole-tag unsynchronization is undone in memory,
+	 * otherwise only the wanted frames are read */
+	data = NULL;
+	if (ver < 4 && (flags & 0x80)) {
+		n = MIN(size, META_TAG_MAX);
+		data = file_alloc(file, 10, n);
+		if (!data) return true;
+		for (i = k = 0; i < n; i++) {
+			data[k++] = data[i];
+			if (data[i] == 0xff && i + 1 < n && !data[i + 1])
+				i++;
+		}
+		src.buf = data;
+		src.len = k;
+	}
+
+	pos = 0;
+	if (ver >= 3 && (flags & 0x40)) {
+		if (!src_read(&src, 0, fh, 4)) goto done;
+		pos = ver == 3 ? 4 + be32(fh) : syncsafe(fh);
+	}
+
+	hlen = ver == 2 ? 6 : 10;
+	while (pos + hlen <= src.len) {
+		if (!src_read(&src, pos, fh, hlen) || !fh[0])
+			break;
+
+		if (ver == 2)
+			fsize = be24(fh + 3);
+		else if (ver == 3)
+			fsize = be32(fh + 4);
+		else
+			fsize = syncsafe(fh + 4);
+
+		pos += hlen;
+		if (fsize > src.len - pos) break;
+
+		id3_frame(&src, pos, fsize, fh, ver, meta);
+		pos += fsize;
+	}
+
+done:
+	free(data);
+
+	return true;
+}
+
+bool
+id3v1_parse(struct meta_file *file, struct meta *meta)
+{
+	uint8_t tag[128];
+
+	if (file->size < 128 || !file_read(file, file->size - 128, tag, 128))
+		return false;
+
+	if (memcmp(tag, "TAG", 3))
+		return false;
+
+	meta_set(&meta->title, meta_text(tag + 3, 30, TEXT_LATIN1));
+	meta_set(&meta->artist, meta_text(tag + 33, 30, TEXT_LATIN1));
+
+	return true;
+}
+
+void
+mpeg_duration(struct meta_file *file, uint64_t audio, uint64_t tail,
+	bool strict, struct meta *meta)
+{
+	static const uint16_t kbps[2][3][16] = {
+		{
+			{ 0, 32, 64, 96, 128, 160, 192, 224,
+				256, 288, 320, 352, 384, 416, 448 },
+			{ 0, 32, 48, 56, 64, 80, 96, 112,
+				128, 160, 192, 224, 256, 320, 384 },
+			{ 0, 32, 40, 48, 56, 64, 80, 96,
+				112, 128, 160, 192, 224, 256, 320 },
+		},
+		{
+			{ 0, 32, 48, 56, 64, 80, 96, 112,
+				128, 144, 160, 176, 192, 224, 256 },
+			{ 0, 8, 16, 24, 32, 40, 48, 56,
+				64, 80, 96, 112, 128, 144, 160 },
+			{ 0, 8, 16, 24, 32, 40, 48, 56,
+				64, 80, 96, 112, 128, 144, 160 },
+		}
+	};
+	static const uint32_t rates[3] = { 44100, 48000, 32000 };
+	uint8_t buf[META_PROBE];
+	uint32_t rate, spf, kb;
+	int version, layer, side;
+	uint64_t frames, end;
+	size_t i, len, off;
+	bool mono;
+
+	end = file->size - MIN(tail, file->size);
+	if (audio >= end) return;
+	len = MIN(sizeof(buf), end - audio);
+	if (!file_read(file, audio, buf, len)) return;
+
+	/* the first frame header, after padding */
+	for (i = 0; i + 4 <= len; i++) {
+		if (strict && i > 0) return;
+		if (buf[i] != 0xff || (buf[i + 1] & 0xe0) != 0xe0)
+			continue;
+		version = buf[i + 1] >> 3 & 3;
+		layer = buf[i + 1] >> 1 & 3;
+		if (version == 1 || layer == 0) continue;
+		if ((buf[i + 2] >> 4) == 15 || (buf[i + 2] >> 2 & 3) == 3)
+			continue;
+		break;
+	}
+	if (i + 4 > len) return;
+
+	mono = (buf[i + 3] >> 6) == 3;
+	rate = rates[buf[i + 2] >> 2 & 3] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+	layer = 3 - layer; /* 0: layer I .. 2: layer III */
+	spf = layer == 0 ? 384 : layer == 1 || version == 3 ? 1152 : 576;
+	kb = kbps[version != 3][layer][buf[i + 2] >> 4];
+
+	/* vbr files carry a frame count in the first frame */
+	frames = 0;
+	if (version == 3)
+		side = mono ? 17 : 32;
+	else
+		side = mono ? 9 : 17;
+	off = i + 4 + side;
+	if (off + 12 <= len && (!memcmp(buf + off, "Xing", 4)
+			|| !memcmp(buf + off, "Info", 4))) {
+		if (be32(buf + off + 4) & 1)
+			frames = be32(buf + off + 8);
+	} else if (i + 36 + 18 <= len && !memcmp(buf + i + 36, "VBRI", 4)) {
+		frames = be32(buf + i + 36 + 14);
+	}
+
+	if (frames)
+		meta->duration = frames * spf * 1000 / rate;
+	else if (kb)
+		meta->duration = (end - audio - i) * 8 / kb;
+}
+
+void
+flac_parse(struct meta_file *file, uint64_t pos, struct meta *meta)
+{
+	uint8_t hdr[4], info[34], *data;
+	uint64_t len, samples;
+	uint32_t rate;
+	bool last;
+
+	do {
+		if (!file_read(file, pos, hdr, 4)) return;
+		last = hdr[0] & 0x80;
+		len = be24(hdr + 1);
+		pos += 4;
+
+		switch (hdr[0] & 0x7f) {
+		case 0: /* STREAMINFO */
+			if (len < 34 || !file_read(file, pos, info, 34))
+				break;
+			rate = (uint32_t) info[10] << 12
+				| (uint32_t) info[11] << 4 | info[12] >> 4;
+			samples = (uint64_t) (info[13] & 0x0f) << 32
+				| be32(info + 14);
+			if (rate) meta->duration = samples * 1000 / rate;
+			break;
+		case 4: /* VORBIS_COMMENT */
+			if (len > META_TAG_MAX) break;
+			data = file_alloc(file, pos, len);
+			if (!data) break;
+			vorbis_comments(data, len, meta);
+			free(data);
+			break;
+		}
+
+		pos += len;
+	} while (!last);
+}
+
+void
+ogg_parse(struct meta_file *file, struct meta *meta)
+{
+	uint8_t hdr[27], segs[255], *page, *pkt[2];
+	uint64_t pos, body, granule, tail;
+	size_t len[2], off, cap;
+	uint32_t serial, rate, skip;
+	int npkt, nseg, i;
+	bool first;
+
+	page = malloc(255 * 255);
+	if (!page) ERROR(SYSTEM, "malloc");
+
+	/* the identification and comment packets of the first stream */
+	pkt[0] = pkt[1] = NULL;
+	len[0] = len[1] = 0;
+	cap = 0;
+	npkt = 0;
+	serial = 0;
+	first = true;
+	for (pos = 0; npkt < 2; pos += body) {
+		if (!file_read(file, pos, hdr, 27) || memcmp(hdr, "OggS", 4))
+			break;
+		nseg = hdr[26];
+		if (!file_read(file, pos + 27, segs, nseg))
+			break;
+		pos += 27 + nseg;
+
+		for (body = i = 0; i < nseg; i++)
+			body += segs[i];
+
+		if (first)
+			serial = le32(hdr + 14);
+		first = false;
+		if (le32(hdr + 14) != serial)
+			continue;
+		if (!file_read(file, pos, page, body))
+			break;
+
+		for (off = i = 0; i < nseg && npkt < 2; i++) {
+			/* large packets are truncated, tags stay in front */
+			if (len[npkt] + segs[i] <= META_TAG_MAX) {
+				if (len[npkt] + segs[i] > cap) {
+					cap = MAX(len[npkt] + segs[i], 2 * cap);
+					pkt[npkt] = realloc(pkt[npkt], cap);
+					if (!pkt[npkt]) ERROR(SYSTEM, "realloc");
+				}
+				memcpy(pkt[npkt] + len[npkt], page + off, segs[i]);
+				len[npkt] += segs[i];
+			}
+			off += segs[i];
+			if (segs[i] < 255) {
+				npkt += 1;
+				cap = 0;
+			}
+		}
+	}
+
+	rate = skip = 0;
+	if (pkt[0] && len[0] >= 16 && !memcmp(pkt[0], "\x01vorbis", 7)) {
+		rate = le32(pkt[0] + 12);
+		if (pkt[1] && len[1] > 7 && !memcmp(pkt[1], "\x03vorbis", 7))
+			vorbis_comments(pkt[1] + 7, len[1] - 7, meta);
+	} else if (pkt[0] && len[0] >= 12 && !memcmp(pkt[0], "OpusHead", 8)) {
+		rate = 48000;
+		skip = le16(pkt[0] + 10);
+		if (pkt[1] && len[1] > 8 && !memcmp(pkt[1], "OpusTags", 8))
+			vorbis_comments(pkt[1] + 8, len[1] - 8, meta);
+	}
+
+	/* duration from the granule of the last page */
+	tail = MIN(file->size, 255 * 255);
+	if (rate && file_read(file, file->size - tail, page, tail)) {
+		for (off = tail - MIN(tail, 27) + 1; off-- > 0; ) {
+			if (memcmp(page + off, "OggS", 4)) continue;
+			if (le32(page + off + 14) != serial) continue;
+			granule = le64(page + off + 6);
+			if (granule == UINT64_MAX) continue;
+			if (granule > skip)
+				meta->duration = (granule - skip) * 1000 / rate;
+			break;
+		}
+	}
+
+	free(pkt[0]);
+	free(pkt[1]);
+	free(page);
+}
+
+void
+mp4_text(struct meta_file *file, uint64_t pos, uint64_t end, char **field)
+{
+	uint8_t hdr[16], *data;
+	uint64_t size;
+
+	/* a single data box with type and locale */
+	if (!file_read(file, pos, hdr, 16) || memcmp(hdr + 4, "data", 4))
+		return;
+	size = be32(hdr);
+	if (size < 16 || size > end - pos || size - 16 > META_TEXT_MAX)
+		return;
+	if (be32(hdr + 8) != 1) return;
+
+	data = file_alloc(file, pos + 16, size - 16);
+	if (!data) return;
+	meta_set(field, meta_text(data, size - 16, TEXT_UTF8));
+	free(data);
+}
+
+void
+mp4_walk(struct meta_file *file, uint64_t pos, uint64_t end,
+	int depth, bool ilst, struct meta *meta)
+{
+	uint8_t hdr[32];
+	uint64_t size, body, scale, duration;
+
+	while (pos + 8 <= end) {
+		if (!file_read(file, pos, hdr, 8)) return;
+		size = be32(hdr);
+		body = 8;
+		if (size == 1) {
+			if (!file_read(file, pos + 8, hdr + 8, 8)) return;
+			size = be64(hdr + 8);
+			body = 16;
+		} else if (size == 0) {
+			size = end - pos;
+		}
+		if (size < body || size > end - pos) return;
+
+		/* only box headers are read on the way to the tags,
+		 * media data is skipped over */
+		if (ilst && !memcmp(hdr + 4, "\xa9nam", 4)) {
+			mp4_text(file, pos + body, pos + size, &meta->title);
+		} else if (ilst && !memcmp(hdr + 4, "\xa9""ART", 4)) {
+			mp4_text(file, pos + body, pos + size, &meta->artist);
+		} else if (depth >= META_MP4_DEPTH) {
+			;
+		} else if (!memcmp(hdr + 4, "moov", 4)
+				|| !memcmp(hdr + 4, "udta", 4)) {
+			mp4_walk(file, pos + body, pos + size,
+				depth + 1, false, meta);
+		} else if (!memcmp(hdr + 4, "ilst", 4)) {
+			mp4_walk(file, pos + body, pos + size,
+				depth + 1, true, meta);
+		} else if (!memcmp(hdr + 4, "meta", 4)) {
+			/* a full box, except in older quicktime files */
+			if (file_read(file, pos + body, hdr + 16, 8)
+					&& memcmp(hdr + 20, "hdlr", 4))
+				body += 4;
+			mp4_walk(file, pos + body, pos + size,
+				depth + 1, false, meta);
+		} else if (!memcmp(hdr + 4, "mvhd", 4)) {
+			if (!file_read(file, pos + body, hdr, 32)) return;
+			if (hdr[0] == 1) {
+				scale = be32(hdr + 20);
+				duration = be64(hdr + 24);
+			} else {
+				scale = be32(hdr + 12);
+				duration = be32(hdr + 16);
+			}
+			if (scale) meta->duration = duration * 1000 / scale;
+		}
+
+		pos += size;
+	}
+}
+
+void
+wav_parse(struct meta_file *file, struct meta *meta)
+{
+	uint8_t hdr[16];
+	uint64_t pos, size;
+	uint32_t byterate;
+
+	byterate = 0;
+	for (pos = 12; pos + 8 <= file->size; pos += 8 + size + (size & 1)) {
+		if (!file_read(file, pos, hdr, 8)) return;
+		size = le32(hdr + 4);
+		if (!memcmp(hdr, "fmt ", 4)) {
+			if (size < 16 || !file_read(file, pos + 8, hdr, 16))
+				return;
+			byterate = le32(hdr + 8);
+		} else if (!memcmp(hdr, "data", 4)) {
+			size = MIN(size, file->size - pos - 8);
+			if (byterate)
+				meta->duration = size * 1000 / byterate;
+			return;
+		}
+	}
+}
+
+void
+meta_parse(const char *path, struct meta *meta)
+{
+	struct meta_file file;
+	uint8_t magic[12];
+	uint64_t audio;
+	bool id3;
+
+	file.fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (file.fd < 0) return;
+	file.size = meta->size;
+
+	if (!file_read(&file, 0, magic, 12)) {
+		close(file.fd);
+		return;
+	}
+
+	if (!memcmp(magic, "OggS", 4)) {
+		ogg_parse(&file, meta);
+	} else if (!memcmp(magic + 4, "ftyp", 4)) {
+		mp4_walk(&file, 0, file.size, 0, false, meta);
+	} else if (!memcmp(magic, "RIFF", 4) && !memcmp(magic + 8, "WAVE", 4)) {
+		wav_parse(&file, meta);
+	} else {
+		audio = 0;
+		id3 = id3_parse(&file, meta, &audio);
+		if (file_read(&file, audio, magic, 4)
+				&& !memcmp(magic, "fLaC", 4)) {
+			flac_parse(&file, audio + 4, meta);
+		} else if (id3v1_parse(&file, meta)) {
+			if (!meta->duration)
+				mpeg_duration(&file, audio, 128, false, meta);
+		} else if (!meta->duration) {
+			/* without tags, only files starting with a frame */
+			mpeg_duration(&file, audio, 0, !id3, meta);
+		}
+	}
+
+	close(file.fd);
+}
+
+int
+entry_cmp(const void *a, const void *b)
+{
+	const struct meta_entry *e1 = a, *e2 = b;
+
+	if (e1->dev != e2->dev)
+		return e1->dev < e2->dev ? -1 : 1;
+	if (e1->ino != e2->ino)
+		return e1->ino < e2->ino ? -1 : 1;
+
+	return 0;
+}
+
+struct meta_entry *
+cache_find(struct meta *meta)
+{
+	struct meta_entry key, *entry;
+
+	key.dev = meta->dev;
+	key.ino = meta->ino;
+	entry = bsearch(&key, cache, cache_count,
+		sizeof(struct meta_entry), entry_cmp);
+	if (!entry) return NULL;
+
+	if (entry->size != meta->size
+			|| entry->mtime.tv_sec != meta->mtime.tv_sec
+			|| entry->mtime.tv_nsec != meta->mtime.tv_nsec)
+		return NULL;
+
+	return entry;
+}
+
+void
+cache_load(void)
+{
+	struct meta_entry *entry;
+	uint32_t alen, tlen;
+	size_t len, off, i;
+	uint8_t *p;
+	char *path;
+	FILE *file;
+
+	cache = NULL;
+	cache_count = 0;
+	cache_blob = NULL;
+	cache_loaded = 0;
+
+	path = aprintf("%s/.metacache", datadir);
+	file = fopen(path, "r");
+	free(path);
+	if (!file) return;
+
+	/* little endian records, see cache_save */
+	fseek(file, 0, SEEK_END);
+	len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	cache_blob = malloc(MAX(len, 1));
+	if (!cache_blob) ERROR(SYSTEM, "malloc");
+	if (fread(cache_blob, 1, len, file) != len)
+		len = 0;
+	fclose(file);
+
+	p = (uint8_t *) cache_blob;
+	if (len < 16 || memcmp(p, META_CACHE_MAGIC, 8)
+			|| le32(p + 8) != META_CACHE_VERSION) {
+		log_info("META: ignoring cache\n");
+		cache_free();
+		return;
+	}
+
+	cache_loaded = MIN(le32(p + 12), len / 44);
+	cache = malloc(MAX(cache_loaded, 1) * sizeof(struct meta_entry));
+	if (!cache) ERROR(SYSTEM, "malloc");
+
+	off = 16;
+	for (i = 0; i < cache_loaded && off + 44 <= len; i++) {
+		entry = &cache[cache_count];
+		entry->dev = le64(p + off);
+		entry->ino = le64(p + off + 8);
+		entry->mtime.tv_sec = (int64_t) le64(p + off + 16);
+		entry->mtime.tv_nsec = le32(p + off + 24);
+		entry->size = le64(p + off + 28);
+		entry->duration = le32(p + off + 36);
+		alen = le16(p + off + 40);
+		tlen = le16(p + off + 42);
+		off += 44;
+
+		/* string lengths include the terminator */
+		if (alen + tlen > len - off) break;
+		if (alen && p[off + alen - 1]) break;
+		if (tlen && p[off + alen + tlen - 1]) break;
+		entry->artist = alen ? cache_blob + off : NULL;
+		entry->title = tlen ? cache_blob + off + alen : NULL;
+		off += alen + tlen;
+
+		cache_count += 1;
+	}
+
+	cache_loaded = cache_count;
+
+	qsort(cache, cache_count, sizeof(struct meta_entry), entry_cmp);
+}
+
+void
+cache_write(FILE *file, const struct meta_entry *entry)
+{
+	uint8_t rec[44];
+	uint32_t alen, tlen;
+
+	alen = entry->artist ? strlen(entry->artist) + 1 : 0;
+	tlen = entry->title ? strlen(entry->title) + 1 : 0;
+	put64(rec, entry->dev);
+	put64(rec + 8, entry->ino);
+	put64(rec + 16, entry->mtime.tv_sec);
+	put32(rec + 24, entry->mtime.tv_nsec);
+	put64(rec + 28, entry->size);
+	put32(rec + 36, entry->duration);
+	put16(rec + 40, alen);
+	put16(rec + 42, tlen);
+	fwrite(rec, 1, 44, file);
+	if (alen) fwrite(entry->artist, 1, alen, file);
+	if (tlen) fwrite(entry->title, 1, tlen, file);
+}
+
+void
+cache_save(void)
+{
+	struct meta_entry *entries;
+	struct link *link;
+	struct meta *meta;
+	size_t count, resident, i;
+	uint8_t hdr[16];
+	char *path, *tmp;
+	FILE *file;
+
+	entries = malloc(MAX(meta_resident + cache_count, 1)
+		* sizeof(struct meta_entry));
+	if (!entries) ERROR(SYSTEM, "malloc");
+
+	count = 0;
+	for (LIST_ITER(&meta_lru, link)) {
+		meta = UPCAST(link, struct meta, link);
+		if (!meta->ino) continue;
+		entries[count].dev = meta->dev;
+		entries[count].ino = meta->ino;
+		entries[count].mtime = meta->mtime;
+		entries[count].size = meta->size;
+		entries[count].duration = meta->duration;
+		entries[count].artist = meta->artist;
+		entries[count].title = meta->title;
+		count += 1;
+	}
+	resident = count;
+	qsort(entries, resident, sizeof(struct meta_entry), entry_cmp);
+
+	/* evicted tracks keep their cached results */
+	for (i = 0; i < cache_count; i++) {
+		if (!bsearch(&cache[i], entries, resident,
+				sizeof(struct meta_entry), entry_cmp))
+			entries[count++] = cache[i];
+	}
+
+	/* nothing new and nothing gone */
+	if (!meta_parsed && count == cache_loaded) {
+		free(entries);
+		return;
+	}
+
+	path = aprintf("%s/.metacache", datadir);
+	tmp = aprintf("%s/.metacache.tmp", datadir);
+
+	file = fopen(tmp, "w");
+	if (!file) goto cleanup;
+
+	memcpy(hdr, META_CACHE_MAGIC, 8);
+	put32(hdr + 8, META_CACHE_VERSION);
+	put32(hdr + 12, count);
+	fwrite(hdr, 1, 16, file);
+
+	for (i = 0; i < count; i++)
+		cache_write(file, &entries[i]);
+
+	if (ferror(file)) {
+		fclose(file);
+		unlink(tmp);
+	} else if (fclose(file) || rename(tmp, path)) {
+		unlink(tmp);
+	}
+
+cleanup:
+	free(entries);
+	free(path);
+	free(tmp);
+}
+
+void
+cache_free(void)
+{
+	free(cache);
+	cache = NULL;
+	cache_count = 0;
+
+	free(cache_blob);
+	cache_blob = NULL;
+}
+
+struct track *
+next_track(struct track *track)
+{
+	struct link *link;
+
+	link = track->link.next;
+	if (!LIST_INNER(link))
+		return NULL;
+
+	return UPCAST(link, struct track, link);
+}
+
+struct meta *
+meta_alloc(struct track *track)
+{
+	struct meta *meta;
+
+	meta = calloc(1, sizeof(struct meta));
+	if (!meta) ERROR(SYSTEM, "calloc");
+	meta->track = track;
+	meta->path = astrdup(track->fpath);
+	meta->link = LINK_EMPTY;
+	track->meta = meta;
+
+	inflight += 1;
+
+	return meta;
+}
+
+void
+meta_free(struct meta *meta)
+{
+	free(meta->artist);
+	free(meta->title);
+	free(meta->path);
+	free(meta);
+}
+
+bool
+meta_scan(struct meta *meta)
+{
+	struct meta_entry *entry;
+	struct stat st;
+
+	if (stat(meta->path, &st) || !S_ISREG(st.st_mode))
+		return false;
+
+	meta->dev = st.st_dev;
+	meta->ino = st.st_ino;
+	meta->mtime = st.st_mtim;
+	meta->size = st.st_size;
+
+	if ((entry = cache_find(meta))) {
+		meta->duration = entry->duration;
+		meta->artist = entry->artist ? astrdup(entry->artist) : NULL;
+		meta->title = entry->title ? astrdup(entry->title) : NULL;
+		return false;
+	}
+
+	meta_parse(meta->path, meta);
+
+	return true;
+}
+
+void *
+meta_worker(void *arg)
+{
+	struct link *link;
+	struct meta *meta;
+	bool parsed;
+
+	pthread_mutex_lock(&meta_lock);
+	while (true) {
+		while (!meta_quit && list_empty(&meta_todo))
+			pthread_cond_wait(&meta_cond, &meta_lock);
+		if (meta_quit) break;
+
+		link = list_pop_front(&meta_todo);
+		meta = UPCAST(link, struct meta, link);
+		meta->started = true;
+		pthread_mutex_unlock(&meta_lock);
+
+		parsed = meta_scan(meta);
+
+		pthread_mutex_lock(&meta_lock);
+		list_push_back(&meta_done, &meta->link);
+		if (parsed) meta_parsed += 1;
+	}
+	pthread_mutex_unlock(&meta_lock);
+
+	return NULL;
+}
+
+int
+meta_collect(void)
+{
+	struct link *link;
+	struct meta *meta;
+	int damage;
+
+	damage = 0;
+
+	pthread_mutex_lock(&meta_lock);
+	while (!list_empty(&meta_done)) {
+		link = list_pop_front(&meta_done);
+		meta = UPCAST(link, struct meta, link);
+		inflight -= 1;
+
+		free(meta->path);
+		meta->path = NULL;
+		if (!meta->track) {
+			meta_free(meta);
+			continue;
+		}
+
+		meta->ready = true;
+		list_push_back(&meta_lru, &meta->link);
+		meta_resident += 1;
+
+		/* background results are only on screen as sums */
+		if (meta->shown)
+			damage |= DAMAGE_TRACKS | DAMAGE_CMD;
+		if (meta->ino && track_scanned(meta->track,
+				meta->size, meta->duration))
+			damage |= DAMAGE_CMD;
+	}
+	pthread_mutex_unlock(&meta_lock);
+
+	return damage;
+}
+
+void
+meta_evict(void)
+{
+	struct link *link;
+	struct meta *meta;
+
+	while (meta_resident > meta_lru_max) {
+		link = list_pop_front(&meta_lru);
+		meta = UPCAST(link, struct meta, link);
+		meta->track->meta = NULL;
+		meta_free(meta);
+		meta_resident -= 1;
+		meta_evicted += 1;
+	}
+}
+
+void
+meta_init(void)
+{
+	const char *envstr;
+	struct link *link;
+	int i;
+
+	list_init(&meta_todo);
+	list_init(&meta_done);
+	list_init(&meta_lru);
+	meta_quit = false;
+	meta_parsed = 0;
+	meta_resident = 0;
+	meta_evicted = 0;
+	inflight = 0;
+
+	envstr = getenv("TMUS_META_LRU");
+	meta_lru_max = envstr ? atoi(envstr) : META_LRU_DEFAULT;
+	meta_lru_max = MAX(meta_lru_max, META_LRU_MIN);
+
+	envstr = getenv("TMUS_META_THREADS");
+	meta_thread_count = envstr ? atoi(envstr) : META_THREADS_DEFAULT;
+	meta_thread_count = MIN(meta_thread_count, META_THREADS_MAX);
+	if (meta_thread_count <= 0) return;
+
+	cache_load();
+
+	link = tracks.head.next;
+	scan_next = LIST_INNER(link) ? UPCAST(link, struct track, link) : NULL;
+
+	for (i = 0; i < meta_thread_count; i++) {
+		if (pthread_create(&meta_threads[i], NULL, meta_worker, NULL))
+			ERROR(SYSTEM, "pthread_create");
+	}
+
+	meta_active = true;
+}
+
+void
+meta_deinit(void)
+{
+	struct link *link;
+	struct meta *meta;
+	int i;
+
+	if (!meta_active) return;
+
+	/* scans not started yet are dropped */
+	pthread_mutex_lock(&meta_lock);
+	meta_quit = true;
+	while (!list_empty(&meta_todo)) {
+		link = list_pop_front(&meta_todo);
+		meta = UPCAST(link, struct meta, link);
+		if (meta->track) meta->track->meta = NULL;
+		meta_free(meta);
+		inflight -= 1;
+	}
+	pthread_cond_broadcast(&meta_cond);
+	pthread_mutex_unlock(&meta_lock);
+
+	for (i = 0; i < meta_thread_count; i++)
+		pthread_join(meta_threads[i], NULL);
+
+	meta_collect();
+	ASSERT(inflight == 0);
+
+	cache_save();
+	cache_free();
+
+	scan_next = NULL;
+	meta_active = false;
+}
+
+void
+meta_update(void)
+{
+	struct track *track;
+	struct meta *meta;
+	bool queued;
+
+	if (!meta_active) return;
+
+	tui_damage(meta_collect());
+	meta_evict();
+
+	/* keep the workers busy without queueing every track at once,
+	 * beyond the lru size only shown tracks are scanned */
+	queued = false;
+	pthread_mutex_lock(&meta_lock);
+	while (inflight < META_INFLIGHT && scan_next
+			&& meta_resident + inflight < meta_lru_max) {
+		track = scan_next;
+		scan_next = next_track(track);
+		if (track->meta) continue;
+
+		meta = meta_alloc(track);
+		list_push_back(&meta_todo, &meta->link);
+		queued = true;
+	}
+	if (queued) pthread_cond_broadcast(&meta_cond);
+	pthread_mutex_unlock(&meta_lock);
+
+	/* the cache only serves the initial scan, unless
+	 * evicted tracks may be shown again */
+	if (!scan_next && !inflight && cache_blob && !meta_evicted) {
+		log_info("META: scanned %i files, %lu cached\n",
+			meta_parsed, cache_count);
+		cache_free();
+	}
+}
+
+void
+meta_track_added(struct track *track)
+{
+	if (meta_active && !scan_next)
+		scan_next = track;
+}
+
+void
+meta_forget_track(struct track *track)
+{
+	if (scan_next == track)
+		scan_next = next_track(track);
+
+	if (!track->meta) return;
+
+	/* a pending scan is freed once the worker is done */
+	if (meta_active && !track->meta->ready) {
+		track->meta->track = NULL;
+	} else {
+		if (track->meta->ready) {
+			link_pop(&track->meta->link);
+			meta_resident -= 1;
+		}
+		meta_free(track->meta);
+	}
+	track->meta = NULL;
+}
+
+void
+meta_want(struct track *track)
+{
+	struct meta *meta;
+
+	if (!meta_active) return;
+
+	meta = track->meta;
+	if (meta && meta->ready) {
+		link_pop(&meta->link);
+		list_push_back(&meta_lru, &meta->link);
+		return;
+	}
+
+	if (meta) meta->shown = true;
+
+	/* jump the queue, unless a worker has it already */
+	pthread_mutex_lock(&meta_lock);
+	if (!meta) {
+		meta = meta_alloc(track);
+		meta->shown = true;
+	} else if (!meta->started) {
+		link_pop(&meta->link);
+	} else {
+		pthread_mutex_unlock(&meta_lock);
+		return;
+	}
+	list_push_front(&meta_todo, &meta->link);
+	pthread_cond_signal(&meta_cond);
+	pthread_mutex_unlock(&meta_lock);
+}
+
+struct meta *
+meta_get(struct track *track)
+{
+	if (!track->meta || !track->meta->ready)
+		return NULL;
+
+	return track->meta;
+}
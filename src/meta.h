@@ -0,0 +1,45 @@
+#pragma once
+
+#include "list.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+struct track;
+
+/* container header metadata, filled by scanner threads */
+struct meta {
+	/* cache key */
+	uint64_t dev, ino;
+	struct timespec mtime;
+	uint64_t size;
+
+	uint32_t duration; /* ms, 0 if unknown */
+	char *artist, *title; /* NULL if unknown */
+
+	/* nothing above is valid before the scan completed */
+	bool ready;
+
+	/* scanner state, track is cleared once it is removed */
+	struct track *track;
+	char *path;
+	bool started;
+	bool shown;
+
+	/* scan queue while pending, then the lru */
+	struct link link;
+};
+
+void meta_init(void);
+void meta_deinit(void);
+void meta_update(void);
+
+void meta_track_added(struct track *track);
+void meta_forget_track(struct track *track);
+
+/* scans ahead of the background scan, or marks as recently shown */
+void meta_want(struct track *track);
+
+/* NULL while the track is not scanned yet */
+struct meta *meta_get(struct track *track);
@@ -0,0 +1,267 @@
+#include "olist.h"
+
+#include "util.h"
+
+static unsigned int olist_rand(void);
+static unsigned int onode_size(struct onode *node);
+static void onode_resize(struct onode *node);
+static void onode_reset(struct onode *node);
+static void onode_rotate_up(struct olist *olist, struct onode *node);
+static unsigned int onode_calc_sizes(struct onode *node);
+
+unsigned int
+olist_rand(void)
+{
+	static unsigned int state = 0x9e3779b9;
+
+	/* xorshift32, only used for treap priorities */
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	return state;
+}
+
+unsigned int
+onode_size(struct onode *node)
+{
+	return node ? node->size : 0;
+}
+
+void
+onode_resize(struct onode *node)
+{
+	node->size = 1 + onode_size(node->left) + onode_size(node->right);
+}
+
+void
+onode_reset(struct onode *node)
+{
+	node->owner = NULL;
+	node->parent = NULL;
+	node->left = NULL;
+	node->right = NULL;
+	node->size = 0;
+}
+
+void
+onode_rotate_up(struct olist *olist, struct onode *node)
+{
+	struct onode *parent, *grand;
+
+	parent = node->parent;
+	grand = parent->parent;
+
+	if (parent->left == node) {
+		parent->left = node->right;
+		if (node->right) node->right->parent = parent;
+		node->right = parent;
+	} else {
+		parent->right = node->left;
+		if (node->left) node->left->parent = parent;
+		node->left = parent;
+	}
+	parent->parent = node;
+
+	node->parent = grand;
+	if (!grand)
+		olist->root = node;
+	else if (grand->left == parent)
+		grand->left = node;
+	else
+		grand->right = node;
+
+	onode_resize(parent);
+	onode_resize(node);
+}
+
+unsigned int
+onode_calc_sizes(struct onode *node)
+{
+	if (!node) return 0;
+
+	node->size = 1 + onode_calc_sizes(node->left)
+		+ onode_calc_sizes(node->right);
+
+	return node->size;
+}
+
+void
+olist_init(struct olist *olist)
+{
+	list_init(&olist->list);
+	olist->root = NULL;
+}
+
+void
+olist_clear(struct olist *olist)
+{
+	struct link *link;
+
+	for (LIST_ITER(&olist->list, link))
+		onode_reset(UPCAST(link, struct onode, link));
+
+	list_clear(&olist->list);
+	olist->root = NULL;
+}
+
+void
+olist_push_back(struct olist *olist, struct onode *node)
+{
+	struct onode *iter;
+
+	ASSERT(!onode_inuse(node));
+
+	list_push_back(&olist->list, &node->link);
+
+	onode_reset(node);
+	node->owner = olist;
+	node->size = 1;
+	node->prio = olist_rand();
+
+	if (!olist->root) {
+		olist->root = node;
+		return;
+	}
+
+	/* append as rightmost leaf, then restore heap order */
+	iter = olist->root;
+	while (iter->right) {
+		iter->size += 1;
+		iter = iter->right;
+	}
+	iter->size += 1;
+	iter->right = node;
+	node->parent = iter;
+
+	while (node->parent && node->parent->prio < node->prio)
+		onode_rotate_up(olist, node);
+}
+
+struct link *
+olist_pop_front(struct olist *olist)
+{
+	struct link *link;
+
+	link = list_front(&olist->list);
+	if (!link) return NULL;
+
+	onode_pop(UPCAST(link, struct onode, link));
+
+	return link;
+}
+
+void
+onode_pop(struct onode *node)
+{
+	struct onode *child, *iter;
+	struct olist *olist;
+
+	olist = node->owner;
+	if (!olist) return;
+
+	/* rotate down until node is a leaf */
+	while (node->left || node->right) {
+		if (!node->right)
+			child = node->left;
+		else if (!node->left)
+			child = node->right;
+		else if (node->left->prio > node->right->prio)
+			child = node->left;
+		else
+			child = node->right;
+		onode_rotate_up(olist, child);
+	}
+
+	if (!node->parent) {
+		olist->root = NULL;
+	} else {
+		if (node->parent->left == node)
+			node->parent->left = NULL;
+		else
+			node->parent->right = NULL;
+
+		for (iter = node->parent; iter; iter = iter->parent)
+			iter->size -= 1;
+	}
+
+	link_pop(&node->link);
+	onode_reset(node);
+}
+
+struct link *
+olist_at(struct olist *olist, int index)
+{
+	struct onode *node;
+	int left;
+
+	if (index < 0 || index >= olist_len(olist))
+		return NULL;
+
+	node = olist->root;
+	while (node) {
+		left = onode_size(node->left);
+		if (index < left) {
+			node = node->left;
+		} else if (index > left) {
+			index -= left + 1;
+			node = node->right;
+		} else {
+			return &node->link;
+		}
+	}
+
+	return NULL;
+}
+
+int
+olist_index(struct olist *olist, struct onode *node)
+{
+	int index;
+
+	if (node->owner != olist)
+		return -1;
+
+	index = onode_size(node->left);
+	for (; node->parent; node = node->parent) {
+		if (node->parent->right == node)
+			index += onode_size(node->parent->left) + 1;
+	}
+
+	return index;
+}
+
+void
+olist_sort(struct olist *olist, bool reverse, olist_cmp cmp)
+{
+	struct onode *node, *last, *iter, *below;
+	struct link *link;
+
+	list_sort(&olist->list, reverse, cmp);
+
+	/* rebuild the treap in list order, keeping priorities */
+	olist->root = NULL;
+	last = NULL;
+	for (LIST_ITER(&olist->list, link)) {
+		node = UPCAST(link, struct onode, link);
+		node->left = node->right = NULL;
+
+		below = NULL;
+		for (iter = last; iter && iter->prio < node->prio;
+				iter = iter->parent)
+			below = iter;
+
+		node->left = below;
+		if (below) below->parent = node;
+
+		node->parent = iter;
+		if (iter)
+			iter->right = node;
+		else
+			olist->root = node;
+
+		last = node;
+	}
+
+	onode_calc_sizes(olist->root);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "list.h"
+
+#include <stdbool.h>
+
+/* liblist list with an order-statistic treap over its links,
+ * giving O(log n) positional access with stable handles */
+struct olist {
+	struct list list;
+	struct onode *root;
+};
+
+struct onode {
+	struct link link; /* position in olist->list */
+	struct olist *owner;
+
+	struct onode *parent, *left, *right;
+	unsigned int size, prio;
+};
+
+#define ONODE_EMPTY ((struct onode) { .link = LINK_EMPTY })
+
+typedef bool (*olist_cmp)(struct link *l1, struct link *l2);
+
+void olist_init(struct olist *olist);
+void olist_clear(struct olist *olist);
+
+void olist_push_back(struct olist *olist, struct onode *node);
+struct link *olist_pop_front(struct olist *olist);
+void onode_pop(struct onode *node);
+
+struct link *olist_at(struct olist *olist, int index);
+int olist_index(struct olist *olist, struct onode *node);
+
+void olist_sort(struct olist *olist, bool reverse, olist_cmp cmp);
+
+static inline int
+olist_len(const struct olist *olist)
+{
+	return olist->root ? (int) olist->root->size : 0;
+}
+
+static inline bool
+olist_empty(const struct olist *olist)
+{
+	return !olist->root;
+}
+
+static inline bool
+onode_inuse(const struct onode *node)
+{
+	return node->owner != NULL;
+}
@@ -14,8 +14,10 @@ pane_init(struct pane *pane, pane_handler handle, pane_updater update)
 {
 	pane->win = newwin(1, 1, 0, 0);
 	ASSERT(pane->win != NULL);
+	idlok(pane->win, TRUE);
 	pane->handle = handle;
 	pane->update = update;
+	pane->dirty = true;
 }
 
 void
@@ -35,6 +37,7 @@ pane_resize(struct pane *pane, int sx, int sy, int ex, int ey)
 	pane->h = pane->ey - pane->sy;
 
 	pane->active = (pane->w > 0 && pane->h > 0);
+	pane->dirty = true;
 	if (pane->active) {
 		wresize(pane->win, pane->h, pane->w);
 		mvwin(pane->win, pane->sy, pane->sx);
@@ -43,13 +46,21 @@ pane_resize(struct pane *pane, int sx, int sy, int ex, int ey)
 }
 
 void
-pane_clearln(struct pane *pane, int row)
+pane_scroll(struct pane *pane, int top, int lines)
 {
-	int i;
+	/* scrollok only while shifting, so writing the
+	 * bottom-right cell never scrolls the pane */
+	wsetscrreg(pane->win, top, pane->h - 1);
+	scrollok(pane->win, TRUE);
+	wscrl(pane->win, lines);
+	scrollok(pane->win, FALSE);
+}
 
-	wmove(pane->win, row, 0);
-	for (i = 0; i < pane->w; i++)
-		waddch(pane->win, ' ');
+void
+pane_clearln(struct pane *pane, int row)
+{
+	/* fill with current attributes, unlike wclrtoeol */
+	mvwhline(pane->win, row, 0, ' ' | getattrs(pane->win), pane->w);
 }
 
 void
@@ -60,3 +71,25 @@ pane_writeln(struct pane *pane, int row, const char *str)
 	waddstr(pane->win, str);
 }
 
+void
+pane_writeln_cols(struct pane *pane, int row,
+	struct dispstr *disp, const char *str, const char *cols)
+{
+	int len, w, cw;
+
+	/* ascii columns are right aligned, the name is cut short */
+	cw = cols ? strlen(cols) : 0;
+	if (cw >= pane->w) cw = 0;
+	w = pane->w - cw;
+
+	len = dispstr_fit(disp, str, w);
+
+	wmove(pane->win, row, 0);
+	waddnwstr(pane->win, disp->wstr, len);
+	if (disp->fit_width < w) {
+		whline(pane->win, ' ' | getattrs(pane->win),
+			w - disp->fit_width);
+	}
+	if (cw) mvwaddstr(pane->win, row, w, cols);
+}
+
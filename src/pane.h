@@ -4,6 +4,8 @@
 
 #include <ncurses.h>
 
+#include "dispstr.h"
+
 #include <stdbool.h>
 
 struct pane;
@@ -17,6 +19,9 @@ struct pane {
 	int w, h;
 	int active;
 
+	/* redraw all rows on next update */
+	bool dirty;
+
 	pane_handler handle;
 	pane_updater update;
 };
@@ -25,6 +30,9 @@ void pane_init(struct pane *pane, pane_handler handle, pane_updater update);
 void pane_deinit(struct pane *pane);
 
 void pane_resize(struct pane *pane, int sx, int sy, int ex, int ey);
+void pane_scroll(struct pane *pane, int top, int lines);
 void pane_clearln(struct pane *pane, int y);
 void pane_writeln(struct pane *pane, int y, const char *line);
+void pane_writeln_cols(struct pane *pane, int y,
+	struct dispstr *disp, const char *line, const char *cols);
 
@@ -1,7 +1,38 @@
 #include "player.h"
 
+#include "tui.h"
 #include "list.h"
 #include "data.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(PLAYER_MPLAY) && !defined(PLAYER_MPD) \
+	&& !defined(PLAYER_SIM) && !defined(PLAYER_LOCAL)
+#error "No player backend enabled"
+#endif
+
+struct player player;
+
+const struct player_backend *const player_backends[] = {
+#ifdef PLAYER_MPLAY
+	&player_backend_mplay,
+#endif
+#ifdef PLAYER_MPD
+	&player_backend_mpd,
+#endif
+#ifdef PLAYER_LOCAL
+	&player_backend_local,
+#endif
+#ifdef PLAYER_SIM
+	&player_backend_sim,
+#endif
+};
+
+const size_t player_backend_count = ARRLEN(player_backends);
+
+static const struct player_backend *player_find_backend(const char *name);
 
 static bool player_history_contains(struct track *cmp, int depth);
 static struct track *playlist_track_next_unused(struct link *start);
@@ -34,12 +65,12 @@ playlist_track_next_unused(struct link *start)
 
 	track = NULL;
 
-	len = list_len(&player.playlist);
+	len = olist_len(&player.playlist);
 	if (!len) return NULL;
 
 	link = start;
 	while (LIST_INNER(link)) {
-		track = UPCAST(link, struct track, link_pl);
+		track = UPCAST(link, struct track, link_pl.link);
 
 		in_history = player_history_contains(track, len - 2);
 		if (track != player.track && !in_history)
@@ -47,7 +78,7 @@ playlist_track_next_unused(struct link *start)
 
 		link = link->next;
 		if (!LIST_INNER(link))
-			link = list_front(&player.playlist);
+			link = list_front(&player.playlist.list);
 
 		if (link == start)
 			return NULL;
@@ -62,40 +93,150 @@ player_next_from_playlist(void)
 	struct link *link;
 	int index;
 
-	if (list_empty(&player.playlist))
+	if (olist_empty(&player.playlist))
 		return NULL;
 
 	if (player.shuffle) {
-		index = rand() % list_len(&player.playlist);
-		link = list_at(&player.playlist, index);
+		index = rand() % olist_len(&player.playlist);
+		link = olist_at(&player.playlist, index);
 		return playlist_track_next_unused(link);
 	} else {
-		if (player.track && link_inuse(&player.track->link_pl)) {
-			index = list_index(&player.playlist,
+		if (player.track && onode_inuse(&player.track->link_pl)) {
+			index = olist_index(&player.playlist,
 				&player.track->link_pl);
 			ASSERT(index >= 0);
-			if (++index == list_len(&player.playlist))
+			if (++index == olist_len(&player.playlist))
 				return NULL;
 		} else {
 			index = 0;
 		}
-		link = list_at(&player.playlist, index);
-		return UPCAST(link, struct track, link_pl);
+		link = olist_at(&player.playlist, index);
+		return UPCAST(link, struct track, link_pl.link);
 	}
 
 	return NULL;
 }
 
-/* implemented by backend:
- *
- * void player_init(void);
- * void player_deinit(void);
- *
- * void player_update(void);
- *
- * int player_play_track(struct track *track, bool new);
- * int player_clear_track(void);
- */
+const struct player_backend *
+player_find_backend(const char *name)
+{
+	int i;
+
+	for (i = 0; i < player_backend_count; i++) {
+		if (!strcmp(player_backends[i]->name, name))
+			return player_backends[i];
+	}
+
+	return NULL;
+}
+
+void
+player_init(void)
+{
+	const char *envstr;
+
+	olist_init(&player.playlist);
+	list_init(&player.history);
+	list_init(&player.queue);
+	memset(&player.playlist_stats, 0, sizeof(struct track_stats));
+	memset(&player.queue_stats, 0, sizeof(struct track_stats));
+
+	player.track = NULL;
+	player.track_name = NULL;
+
+	player.loaded = false;
+	player.autoplay = true;
+	player.shuffle = true;
+
+	player.state = PLAYER_STATE_PAUSED;
+	player.volume = 50;
+
+	player.time_pos = 0;
+	player.time_end = 0;
+
+	player.latency_ms = -1;
+	player.underruns = -1;
+
+	player.status = NULL;
+	player.status_lvl = PLAYER_STATUS_MSG_NONE;
+
+	player.backend = player_backends[0];
+	envstr = getenv("TMUS_PLAYER");
+	if (envstr) {
+		player.backend = player_find_backend(envstr);
+		if (!player.backend)
+			ERRORX(USER, "Player backend '%s' not available", envstr);
+	}
+
+	player.backend->init();
+}
+
+void
+player_deinit(void)
+{
+	player.backend->deinit();
+
+#ifdef LEAKCHECK
+	playlist_clear();
+	player_queue_clear();
+	list_clear(&player.history);
+
+	free(player.status);
+	free(player.track_name);
+#endif
+}
+
+int
+player_set_backend(const char *name)
+{
+	const struct player_backend *backend;
+	struct track *track;
+
+	backend = player_find_backend(name);
+	if (!backend) {
+		PLAYER_STATUS("No such backend");
+		return PLAYER_ERR;
+	}
+
+	if (backend == player.backend)
+		return PLAYER_OK;
+
+	/* hand over the current track, not its position */
+	track = player.track;
+	player.backend->clear_track();
+	player.backend->deinit();
+
+	free(player.track_name);
+	player.track_name = NULL;
+	player.loaded = false;
+	player.time_pos = 0;
+	player.time_end = 0;
+
+	player.backend = backend;
+	player.backend->init();
+
+	if (track) return player_play_track(track, false);
+
+	return PLAYER_OK;
+}
+
+void
+player_update(void)
+{
+	player.backend->update();
+}
+
+int
+player_play_track(struct track *track, bool new)
+{
+	return player.backend->play_track(track, new);
+}
+
+int
+player_clear_track(void)
+{
+	return player.backend->clear_track();
+}
 
 void
 player_add_history(struct track *new)
@@ -106,12 +247,70 @@ player_add_history(struct track *new)
 	}
 }
 
-/* implemented by backend:
- *
- * int player_toggle_pause(void);
- * int player_pause(void);
- * int player_resume(void);
- */
+bool
+player_autoplay_next(bool had_track)
+{
+	/* queued tracks play even without autoplay */
+	return (had_track && player.autoplay) || !list_empty(&player.queue);
+}
+
+void
+player_queue_push(struct track *track)
+{
+	player_queue_rm(track);
+	list_push_back(&player.queue, &track->link_pq);
+	track_stats_add(&player.queue_stats, track);
+}
+
+void
+player_queue_rm(struct track *track)
+{
+	if (!link_inuse(&track->link_pq))
+		return;
+
+	link_pop(&track->link_pq);
+	track_stats_rm(&player.queue_stats, track);
+}
+
+struct track *
+player_queue_pop(void)
+{
+	struct track *track;
+	struct link *link;
+
+	link = list_front(&player.queue);
+	if (!link) return NULL;
+
+	track = UPCAST(link, struct track, link_pq);
+	player_queue_rm(track);
+
+	return track;
+}
+
+void
+player_queue_clear(void)
+{
+	list_clear(&player.queue);
+	memset(&player.queue_stats, 0, sizeof(struct track_stats));
+}
+
+int
+player_toggle_pause(void)
+{
+	return player.backend->toggle_pause();
+}
+
+int
+player_pause(void)
+{
+	return player.backend->pause();
+}
+
+int
+player_resume(void)
+{
+	return player.backend->resume();
+}
 
 int
 player_prev(void)
@@ -140,7 +339,6 @@ int
 player_next(void)
 {
 	struct track *next_track;
-	struct link *link;
 	bool new_entry;
 
 	if (player.track && link_inuse(&player.track->link_hs)
@@ -149,8 +347,7 @@ player_next(void)
 			struct track, link_hs);
 		new_entry = false;
 	} else if (!list_empty(&player.queue)) {
-		link = list_pop_front(&player.queue);
-		next_track = UPCAST(link, struct track, link_pq);
+		next_track = player_queue_pop();
 		new_entry = true;
 	} else {
 		next_track = player_next_from_playlist();
@@ -166,12 +363,27 @@ clear:
 	return PLAYER_ERR;
 }
 
-/* implemented by backend:
- *
- * int player_seek(int sec);
- * int player_play(void);
- * int player_stop(void);
- *
- * int player_set_volume(unsigned int vol);
- */
+int
+player_seek(int sec)
+{
+	return player.backend->seek(sec);
+}
+
+int
+player_play(void)
+{
+	return player.backend->play();
+}
+
+int
+player_stop(void)
+{
+	return player.backend->stop();
+}
+
+int
+player_set_volume(unsigned int vol)
+{
+	return player.backend->set_volume(vol);
+}
 
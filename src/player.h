@@ -1,8 +1,12 @@
 #pragma once
 
+#include "data.h"
 #include "list.h"
+#include "olist.h"
 #include "util.h"
 
+struct track;
+
 #define PLAYER_STATUS(...) do { \
 		free(user_status); \
 		user_status = aprintf("Player: " __VA_ARGS__); \
@@ -27,9 +31,33 @@ enum {
 	PLAYER_STATE_STOPPED
 };
 
+struct player_backend {
+	const char *name;
+
+	void (*init)(void);
+	void (*deinit)(void);
+
+	void (*update)(void);
+
+	int (*play_track)(struct track *track, bool new);
+	int (*clear_track)(void);
+
+	int (*toggle_pause)(void);
+	int (*pause)(void);
+	int (*resume)(void);
+	int (*seek)(int sec);
+	int (*play)(void);
+	int (*stop)(void);
+
+	int (*set_volume)(unsigned int vol);
+};
+
 struct player {
+	/* backend selected at runtime (TMUS_PLAYER) */
+	const struct player_backend *backend;
+
 	/* list of tracks to choose from on prev / next */
-	struct list playlist; /* struct track (link_pl) */
+	struct olist playlist; /* struct track (link_pl) */
 
 	/* played track history */
 	struct list history;  /* struct track (link_hs) */
@@ -37,6 +65,9 @@ struct player {
 	/* queued tracks */
 	struct list queue; /* struct track (link_pq) */
 
+	struct track_stats playlist_stats;
+	struct track_stats queue_stats;
+
 	/* last used track */
 	struct track *track;
 
@@ -61,6 +92,10 @@ struct player {
 	/* track position and duration */
 	unsigned int time_pos, time_end;
 
+	/* output latency and underruns when known, else -1 */
+	int latency_ms;
+	int underruns;
+
 	/* status messaging */
 	char *status;
 	int status_lvl;
@@ -69,6 +104,8 @@ struct player {
 void player_init(void);
 void player_deinit(void);
 
+int player_set_backend(const char *name);
+
 void player_update(void);
 
 int player_play_track(struct track *track, bool new);
@@ -76,6 +113,15 @@ int player_clear_track(void);
 
 void player_add_history(struct track *track);
 
+/* whether backends continue once a track ends */
+bool player_autoplay_next(bool had_track);
+
+/* queue changes, keeping queue_stats */
+void player_queue_push(struct track *track);
+void player_queue_rm(struct track *track);
+struct track *player_queue_pop(void);
+void player_queue_clear(void);
+
 int player_toggle_pause(void);
 int player_pause(void);
 int player_resume(void);
@@ -87,5 +133,17 @@ int player_stop(void);
 
 int player_set_volume(unsigned int vol);
 
+/* virtual clock control of the sim backend */
+void player_sim_advance(unsigned int ms);
+unsigned long player_sim_transitions(void);
+
 extern struct player player;
 
+extern const struct player_backend *const player_backends[];
+extern const size_t player_backend_count;
+
+extern const struct player_backend player_backend_mplay;
+extern const struct player_backend player_backend_mpd;
+extern const struct player_backend player_backend_sim;
+extern const struct player_backend player_backend_local;
+
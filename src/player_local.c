@@ -0,0 +1,1079 @@
+#define _GNU_SOURCE
+
+#include "player.h"
+
+#include "tui.h"
+#include "data.h"
+#include "list.h"
+#include "ring.h"
+#include "util.h"
+#include "log.h"
+
+#ifdef HAVE_SNDFILE
+#include <sndfile.h>
+#endif
+
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ~1.5s of 44.1kHz stereo, bounds how early gapless
+ * transitions are prepared and the seek flush size */
+#define LOCAL_RING_SIZE (1 << 18)
+#define LOCAL_MARKS 16
+#define LOCAL_CHUNK 1024
+#define LOCAL_CHANNELS_MAX 8
+#define LOCAL_ADVANCE_MS 300
+
+enum {
+	MARK_FLUSH, /* drop everything before, new position */
+	MARK_TRACK, /* gapless start of the next track */
+	MARK_END    /* no more data for this track */
+};
+
+struct local_dec {
+	unsigned int rate, channels;
+	uint64_t frames;
+
+	size_t (*read)(struct local_dec *dec, int16_t *buf, size_t frames);
+	bool (*seek)(struct local_dec *dec, uint64_t frame);
+	void (*close)(struct local_dec *dec);
+
+	void *handle;
+	long data_start;
+};
+
+struct local_sink {
+	const char *name;
+
+	bool (*open)(unsigned int rate, unsigned int channels);
+	bool (*write)(const int16_t *buf, size_t frames);
+	unsigned int (*delay)(void);
+	void (*flush)(void);
+	void (*close)(void);
+};
+
+struct local_mark {
+	size_t pos;
+	int type;
+	unsigned int rate, channels;
+	uint64_t frame;
+	unsigned int serial;
+};
+
+struct local_player {
+	pthread_t decode_thread;
+	pthread_t output_thread;
+
+	/* decoded samples, decode thread -> output thread */
+	struct ring ring;
+
+	/* format and position changes along the ring */
+	struct local_mark marks[LOCAL_MARKS];
+	_Atomic unsigned int mark_head, mark_tail;
+
+	/* requests from main thread to decode thread */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool req_load;
+	struct local_dec *req_dec;
+	bool req_gapless;
+	int64_t req_seek;
+	unsigned int req_serial;
+	_Atomic bool quit;
+
+	/* serial of the track the decode thread finished */
+	_Atomic unsigned int eof;
+
+	/* published by output thread */
+	_Atomic unsigned int serial;
+	_Atomic unsigned int ended;
+	_Atomic uint64_t pos;
+	_Atomic unsigned int rate;
+	_Atomic unsigned int underruns;
+	_Atomic unsigned int latency_ms;
+	_Atomic bool sink_err;
+
+	/* controlled by main thread */
+	_Atomic bool paused;
+	_Atomic int volume;
+
+	const struct local_sink *sink;
+
+	/* track loaded from the main thread's view */
+	unsigned int cur_serial;
+	unsigned int cur_rate;
+	uint64_t cur_frames;
+
+	/* next track is requested by autoplay, not the user */
+	bool advancing;
+	unsigned int advanced;
+};
+
+static struct local_player lp;
+
+static size_t wav_read(struct local_dec *dec, int16_t *buf, size_t frames);
+static bool wav_seek(struct local_dec *dec, uint64_t frame);
+static void wav_close(struct local_dec *dec);
+static struct local_dec *wav_open(const char *path);
+
+#ifdef HAVE_SNDFILE
+static size_t sndfile_read(struct local_dec *dec, int16_t *buf, size_t frames);
+static bool sndfile_seek(struct local_dec *dec, uint64_t frame);
+static void sndfile_close(struct local_dec *dec);
+static struct local_dec *sndfile_open(const char *path);
+#endif
+
+static void local_sleep_us(uint64_t us);
+
+static bool null_open(unsigned int rate, unsigned int channels);
+static bool null_write(const int16_t *buf, size_t frames);
+static unsigned int null_delay(void);
+static void null_flush(void);
+static void null_close(void);
+static bool wavout_open(unsigned int rate, unsigned int channels);
+static bool wavout_write(const int16_t *buf, size_t frames);
+static void wavout_close(void);
+
+#ifdef HAVE_ALSA
+static bool alsa_open(unsigned int rate, unsigned int channels);
+static bool alsa_write(const int16_t *buf, size_t frames);
+static unsigned int alsa_delay(void);
+static void alsa_flush(void);
+static void alsa_close(void);
+#endif
+
+static void local_mark(int type, struct local_dec *dec,
+	uint64_t frame, unsigned int serial);
+static struct local_dec *local_open(const char *path);
+static void local_request(struct local_dec *dec, bool gapless);
+static void *local_decode_main(void *arg);
+static void *local_output_main(void *arg);
+
+static void local_init(void);
+static void local_deinit(void);
+static void local_update(void);
+static int local_play_track(struct track *track, bool new);
+static int local_clear_track(void);
+static int local_toggle_pause(void);
+static int local_pause(void);
+static int local_resume(void);
+static int local_play(void);
+static int local_stop(void);
+static int local_seek(int sec);
+static int local_set_volume(unsigned int vol);
+
+/* state of the null / wav sinks, only used by output thread */
+static FILE *wavout_file;
+static uint32_t wavout_bytes;
+static unsigned int sink_rate, sink_channels;
+static uint64_t sink_due_us;
+
+static const struct local_sink null_sink = {
+	.name = "null",
+	.open = null_open,
+	.write = null_write,
+	.delay = null_delay,
+	.flush = null_flush,
+	.close = null_close,
+};
+
+static const struct local_sink wav_sink = {
+	.name = "wav",
+	.open = wavout_open,
+	.write = wavout_write,
+	.delay = null_delay,
+	.flush = null_flush,
+	.close = wavout_close,
+};
+
+#ifdef HAVE_ALSA
+static snd_pcm_t *alsa_pcm;
+
+static const struct local_sink alsa_sink = {
+	.name = "alsa",
+	.open = alsa_open,
+	.write = alsa_write,
+	.delay = alsa_delay,
+	.flush = alsa_flush,
+	.close = alsa_close,
+};
+#endif
+
+size_t
+wav_read(struct local_dec *dec, int16_t *buf, size_t frames)
+{
+	return fread(buf, 2 * dec->channels, frames, dec->handle);
+}
+
+bool
+wav_seek(struct local_dec *dec, uint64_t frame)
+{
+	frame = MIN(frame, dec->frames);
+
+	return !fseek(dec->handle, dec->data_start
+		+ (long) (frame * 2 * dec->channels), SEEK_SET);
+}
+
+void
+wav_close(struct local_dec *dec)
+{
+	fclose(dec->handle);
+	free(dec);
+}
+
+struct local_dec *
+wav_open(const char *path)
+{
+	struct local_dec *dec;
+	unsigned char hdr[16];
+	uint32_t len;
+	uint16_t format, bits;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file) return NULL;
+
+	/* only 16-bit little endian PCM, the rest needs sndfile */
+	if (fread(hdr, 1, 12, file) != 12 || memcmp(hdr, "RIFF", 4)
+			|| memcmp(hdr + 8, "WAVE", 4))
+		goto fail;
+
+	dec = calloc(1, sizeof(struct local_dec));
+	if (!dec) ERROR(SYSTEM, "calloc");
+
+	while (fread(hdr, 1, 8, file) == 8) {
+		len = hdr[4] | hdr[5] << 8 | hdr[6] << 16
+			| (uint32_t) hdr[7] << 24;
+		if (!memcmp(hdr, "fmt ", 4)) {
+			if (len < 16 || fread(hdr, 1, 16, file) != 16)
+				break;
+			format = hdr[0] | hdr[1] << 8;
+			dec->channels = hdr[2] | hdr[3] << 8;
+			dec->rate = hdr[4] | hdr[5] << 8 | hdr[6] << 16
+				| (uint32_t) hdr[7] << 24;
+			bits = hdr[14] | hdr[15] << 8;
+			if ((format != 1 && format != 0xfffe) || bits != 16)
+				break;
+			fseek(file, len - 16 + (len & 1), SEEK_CUR);
+		} else if (!memcmp(hdr, "data", 4)) {
+			if (!dec->channels || !dec->rate
+					|| dec->channels > LOCAL_CHANNELS_MAX)
+				break;
+			dec->frames = len / (2 * dec->channels);
+			dec->data_start = ftell(file);
+			dec->handle = file;
+			dec->read = wav_read;
+			dec->seek = wav_seek;
+			dec->close = wav_close;
+			return dec;
+		} else {
+			fseek(file, len + (len & 1), SEEK_CUR);
+		}
+	}
+
+	free(dec);
+fail:
+	fclose(file);
+	return NULL;
+}
+
+#ifdef HAVE_SNDFILE
+
+size_t
+sndfile_read(struct local_dec *dec, int16_t *buf, size_t frames)
+{
+	sf_count_t n;
+
+	n = sf_readf_short(dec->handle, buf, frames);
+
+	return n > 0 ? n : 0;
+}
+
+bool
+sndfile_seek(struct local_dec *dec, uint64_t frame)
+{
+	return sf_seek(dec->handle, MIN(frame, dec->frames), SEEK_SET) >= 0;
+}
+
+void
+sndfile_close(struct local_dec *dec)
+{
+	sf_close(dec->handle);
+	free(dec);
+}
+
+struct local_dec *
+sndfile_open(const char *path)
+{
+	struct local_dec *dec;
+	SF_INFO info;
+	SNDFILE *file;
+
+	memset(&info, 0, sizeof(info));
+	file = sf_open(path, SFM_READ, &info);
+	if (!file) return NULL;
+
+	if (!info.channels || info.channels > LOCAL_CHANNELS_MAX) {
+		sf_close(file);
+		return NULL;
+	}
+
+	dec = calloc(1, sizeof(struct local_dec));
+	if (!dec) ERROR(SYSTEM, "calloc");
+	dec->rate = info.samplerate;
+	dec->channels = info.channels;
+	dec->frames = info.frames;
+	dec->handle = file;
+	dec->read = sndfile_read;
+	dec->seek = sndfile_seek;
+	dec->close = sndfile_close;
+
+	return dec;
+}
+
+#endif
+
+void
+local_sleep_us(uint64_t us)
+{
+	struct timespec ts;
+
+	ts.tv_sec = us / 1000000UL;
+	ts.tv_nsec = us % 1000000UL * 1000UL;
+	nanosleep(&ts, NULL);
+}
+
+bool
+null_open(unsigned int rate, unsigned int channels)
+{
+	sink_rate = rate;
+	sink_channels = channels;
+	sink_due_us = current_us();
+
+	return true;
+}
+
+bool
+null_write(const int16_t *buf, size_t frames)
+{
+	uint64_t now;
+
+	/* pace like a device with a 50ms buffer */
+	sink_due_us += frames * 1000000UL / sink_rate;
+	now = current_us();
+	if (sink_due_us < now)
+		sink_due_us = now;
+	else if (sink_due_us > now + 50000)
+		local_sleep_us(sink_due_us - now - 50000);
+
+	return true;
+}
+
+unsigned int
+null_delay(void)
+{
+	uint64_t now;
+
+	now = current_us();
+	if (sink_due_us <= now) return 0;
+
+	return (sink_due_us - now) * sink_rate / 1000000UL;
+}
+
+void
+null_flush(void)
+{
+	sink_due_us = current_us();
+}
+
+void
+null_close(void)
+{
+}
+
+bool
+wavout_open(unsigned int rate, unsigned int channels)
+{
+	static const unsigned char zero[44] = { 0 };
+	const char *path;
+
+	path = getenv("TMUS_LOCAL_SINK");
+	wavout_file = fopen(path, "w+");
+	if (!wavout_file) return false;
+
+	/* header is filled in on close */
+	fwrite(zero, 1, sizeof(zero), wavout_file);
+	wavout_bytes = 0;
+
+	return null_open(rate, channels);
+}
+
+bool
+wavout_write(const int16_t *buf, size_t frames)
+{
+	size_t len;
+
+	len = frames * 2 * sink_channels;
+	if (fwrite(buf, 1, len, wavout_file) != len)
+		return false;
+	wavout_bytes += len;
+
+	return null_write(buf, frames);
+}
+
+void
+wavout_close(void)
+{
+	unsigned char hdr[44];
+	uint32_t vals[] = {
+		36 + wavout_bytes, 16, 1 | sink_channels << 16, sink_rate,
+		sink_rate * 2 * sink_channels, 2 * sink_channels | 16 << 16,
+		wavout_bytes
+	};
+	int i, offs[] = { 4, 16, 20, 24, 28, 32, 40 };
+
+	if (!wavout_file) return;
+
+	memcpy(hdr, "RIFF....WAVEfmt ....................data....", 44);
+	for (i = 0; i < ARRLEN(offs); i++) {
+		hdr[offs[i]] = vals[i];
+		hdr[offs[i] + 1] = vals[i] >> 8;
+		hdr[offs[i] + 2] = vals[i] >> 16;
+		hdr[offs[i] + 3] = vals[i] >> 24;
+	}
+
+	fseek(wavout_file, 0, SEEK_SET);
+	fwrite(hdr, 1, sizeof(hdr), wavout_file);
+	fclose(wavout_file);
+	wavout_file = NULL;
+}
+
+#ifdef HAVE_ALSA
+
+bool
+alsa_open(unsigned int rate, unsigned int channels)
+{
+	int err;
+
+	err = snd_pcm_open(&alsa_pcm, "default", SND_PCM_STREAM_PLAYBACK, 0);
+	if (err < 0) return false;
+
+	err = snd_pcm_set_params(alsa_pcm, SND_PCM_FORMAT_S16_LE,
+		SND_PCM_ACCESS_RW_INTERLEAVED, channels, rate, 1, 100000);
+	if (err < 0) {
+		snd_pcm_close(alsa_pcm);
+		alsa_pcm = NULL;
+		return false;
+	}
+
+	sink_channels = channels;
+
+	return true;
+}
+
+bool
+alsa_write(const int16_t *buf, size_t frames)
+{
+	snd_pcm_sframes_t n;
+
+	while (frames > 0) {
+		n = snd_pcm_writei(alsa_pcm, buf, frames);
+		if (n < 0) {
+			n = snd_pcm_recover(alsa_pcm, n, 1);
+			if (n < 0) return false;
+			continue;
+		}
+		buf += n * sink_channels;
+		frames -= n;
+	}
+
+	return true;
+}
+
+unsigned int
+alsa_delay(void)
+{
+	snd_pcm_sframes_t delay;
+
+	if (snd_pcm_delay(alsa_pcm, &delay) < 0 || delay < 0)
+		return 0;
+
+	return delay;
+}
+
+void
+alsa_flush(void)
+{
+	snd_pcm_drop(alsa_pcm);
+	snd_pcm_prepare(alsa_pcm);
+}
+
+void
+alsa_close(void)
+{
+	if (!alsa_pcm) return;
+
+	snd_pcm_drain(alsa_pcm);
+	snd_pcm_close(alsa_pcm);
+	alsa_pcm = NULL;
+}
+
+#endif
+
+void
+local_mark(int type, struct local_dec *dec, uint64_t frame,
+	unsigned int serial)
+{
+	struct local_mark *mark;
+	unsigned int head;
+
+	/* called with lp.lock held, which is dropped while the output
+	 * thread catches up so requests are not blocked on it */
+	head = atomic_load_explicit(&lp.mark_head, memory_order_relaxed);
+	while (head - atomic_load_explicit(&lp.mark_tail,
+			memory_order_acquire) >= LOCAL_MARKS) {
+		if (lp.quit) return;
+		pthread_mutex_unlock(&lp.lock);
+		local_sleep_us(1000);
+		pthread_mutex_lock(&lp.lock);
+	}
+
+	mark = &lp.marks[head % LOCAL_MARKS];
+	mark->pos = atomic_load_explicit(&lp.ring.head, memory_order_relaxed);
+	mark->type = type;
+	mark->rate = dec ? dec->rate : 0;
+	mark->channels = dec ? dec->channels : 0;
+	mark->frame = frame;
+	mark->serial = serial;
+
+	atomic_store_explicit(&lp.mark_head, head + 1, memory_order_release);
+}
+
+struct local_dec *
+local_open(const char *path)
+{
+	struct local_dec *dec;
+
+#ifdef HAVE_SNDFILE
+	dec = sndfile_open(path);
+	if (dec) return dec;
+#endif
+
+	dec = wav_open(path);
+
+	return dec;
+}
+
+void *
+local_decode_main(void *arg)
+{
+	int16_t buf[LOCAL_CHUNK * LOCAL_CHANNELS_MAX];
+	struct local_dec *dec;
+	struct timespec ts;
+	unsigned int serial;
+	size_t frames, len;
+	int64_t seek;
+	bool gapless;
+
+	dec = NULL;
+	serial = 0;
+
+	pthread_mutex_lock(&lp.lock);
+	while (!lp.quit) {
+		/* requests are taken before marking, which may
+		 * let the main thread post new ones meanwhile */
+		if (lp.req_load) {
+			/* a NULL decoder clears the track */
+			if (dec) dec->close(dec);
+			dec = lp.req_dec;
+			serial = lp.req_serial;
+			gapless = lp.req_gapless;
+			lp.req_load = false;
+			lp.req_dec = NULL;
+			lp.req_gapless = false;
+			local_mark(gapless ? MARK_TRACK : MARK_FLUSH,
+				dec, 0, serial);
+		}
+
+		if (dec && lp.req_seek >= 0) {
+			seek = lp.req_seek;
+			lp.req_seek = -1;
+			if (dec->seek(dec, seek))
+				local_mark(MARK_FLUSH, dec, seek, serial);
+		}
+
+		len = dec ? LOCAL_CHUNK * 2 * dec->channels : 0;
+		if (!dec || ring_space(&lp.ring) < len) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 10 * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec += 1;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&lp.cond, &lp.lock, &ts);
+			continue;
+		}
+
+		/* decode without blocking requests */
+		pthread_mutex_unlock(&lp.lock);
+		frames = dec->read(dec, buf, LOCAL_CHUNK);
+		ring_write(&lp.ring, buf, frames * 2 * dec->channels);
+		pthread_mutex_lock(&lp.lock);
+
+		if (!frames) {
+			dec->close(dec);
+			dec = NULL;
+			local_mark(MARK_END, NULL, 0, serial);
+			atomic_store(&lp.eof, serial);
+		}
+	}
+	pthread_mutex_unlock(&lp.lock);
+
+	if (dec) dec->close(dec);
+
+	return NULL;
+}
+
+void *
+local_output_main(void *arg)
+{
+	int16_t buf[LOCAL_CHUNK * LOCAL_CHANNELS_MAX];
+	struct local_mark *mark;
+	struct sched_param param;
+	unsigned int tail, head, channels, rate;
+	size_t avail, len, frames, i;
+	bool opened, starved, active;
+	int volume;
+
+	/* best effort, needs privileges */
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+	opened = false;
+	starved = false;
+	active = false;
+	channels = rate = 0;
+
+	while (!lp.quit) {
+		/* a flush makes everything queued before it stale,
+		 * earlier marks are dropped instead of played up to */
+		tail = atomic_load_explicit(&lp.mark_tail, memory_order_relaxed);
+		head = atomic_load_explicit(&lp.mark_head, memory_order_acquire);
+		for (; head - tail > 1; head--) {
+			if (lp.marks[(head - 1) % LOCAL_MARKS].type == MARK_FLUSH) {
+				tail = head - 1;
+				atomic_store_explicit(&lp.mark_tail, tail,
+					memory_order_release);
+				break;
+			}
+		}
+
+		/* apply marks which have been reached */
+		avail = ring_avail(&lp.ring);
+		if (tail != atomic_load_explicit(&lp.mark_head,
+				memory_order_acquire)) {
+			mark = &lp.marks[tail % LOCAL_MARKS];
+			if (mark->type == MARK_FLUSH) {
+				ring_skip_to(&lp.ring, mark->pos);
+				if (opened) lp.sink->flush();
+			}
+			if (mark->type == MARK_FLUSH || mark->type == MARK_TRACK) {
+				if (mark->pos != atomic_load(&lp.ring.tail))
+					goto play;
+				if (mark->channels && (mark->rate != rate
+						|| mark->channels != channels)) {
+					if (opened) lp.sink->close();
+					rate = mark->rate;
+					channels = mark->channels;
+					opened = lp.sink->open(rate, channels);
+					if (!opened) atomic_store(&lp.sink_err, true);
+					atomic_store(&lp.rate, rate);
+				}
+				/* decoder needs a moment to refill */
+				starved = true;
+				active = mark->channels != 0;
+				atomic_store(&lp.pos, mark->frame);
+				atomic_store(&lp.serial, mark->serial);
+			} else if (mark->type == MARK_END) {
+				if (mark->pos != atomic_load(&lp.ring.tail))
+					goto play;
+				active = false;
+				atomic_store(&lp.ended, mark->serial);
+			}
+			atomic_store_explicit(&lp.mark_tail, tail + 1,
+				memory_order_release);
+			continue;
+		}
+
+play:
+		if (!opened || !active || atomic_load(&lp.paused)) {
+			local_sleep_us(10000);
+			continue;
+		}
+
+		/* never read past the next mark */
+		if (tail != atomic_load_explicit(&lp.mark_head,
+				memory_order_acquire)) {
+			mark = &lp.marks[tail % LOCAL_MARKS];
+			avail = MIN(avail, mark->pos - atomic_load(&lp.ring.tail));
+		}
+
+		len = MIN(avail, LOCAL_CHUNK * 2 * channels);
+		len -= len % (2 * channels);
+		if (!len) {
+			if (!starved)
+				atomic_fetch_add(&lp.underruns, 1);
+			starved = true;
+			local_sleep_us(2000);
+			continue;
+		}
+		starved = false;
+
+		ring_read(&lp.ring, buf, len);
+		frames = len / (2 * channels);
+
+		volume = atomic_load(&lp.volume);
+		if (volume != 100) {
+			for (i = 0; i < frames * channels; i++)
+				buf[i] = buf[i] * volume / 100;
+		}
+
+		if (!lp.sink->write(buf, frames)) {
+			lp.sink->close();
+			opened = false;
+			rate = channels = 0;
+			continue;
+		}
+
+		atomic_fetch_add(&lp.pos, frames);
+		atomic_store(&lp.latency_ms, lp.sink->delay() * 1000UL / rate);
+	}
+
+	if (opened) lp.sink->close();
+
+	return NULL;
+}
+
+void
+local_init(void)
+{
+	const char *sinkstr;
+
+	ring_init(&lp.ring, LOCAL_RING_SIZE);
+	atomic_init(&lp.mark_head, 0);
+	atomic_init(&lp.mark_tail, 0);
+
+	pthread_mutex_init(&lp.lock, NULL);
+	pthread_cond_init(&lp.cond, NULL);
+	lp.req_load = false;
+	lp.req_dec = NULL;
+	lp.req_gapless = false;
+	lp.req_seek = -1;
+	lp.req_serial = 0;
+	atomic_init(&lp.quit, false);
+
+	atomic_init(&lp.eof, 0);
+	atomic_init(&lp.serial, 0);
+	atomic_init(&lp.ended, 0);
+	atomic_init(&lp.pos, 0);
+	atomic_init(&lp.rate, 0);
+	atomic_init(&lp.underruns, 0);
+	atomic_init(&lp.latency_ms, 0);
+	atomic_init(&lp.sink_err, false);
+	atomic_init(&lp.paused, false);
+	atomic_init(&lp.volume, 100);
+
+	lp.cur_serial = 0;
+	lp.cur_rate = 0;
+	lp.cur_frames = 0;
+	lp.advancing = false;
+	lp.advanced = 0;
+
+	sinkstr = getenv("TMUS_LOCAL_SINK");
+#ifdef HAVE_ALSA
+	lp.sink = &alsa_sink;
+#else
+	lp.sink = &null_sink;
+#endif
+	if (sinkstr && !strcmp(sinkstr, "null"))
+		lp.sink = &null_sink;
+	else if (sinkstr && strcmp(sinkstr, "alsa"))
+		lp.sink = &wav_sink;
+
+	player.volume = 100;
+	player.underruns = 0;
+	player.latency_ms = 0;
+
+	if (pthread_create(&lp.decode_thread, NULL, local_decode_main, NULL))
+		ERROR(SYSTEM, "pthread_create");
+	if (pthread_create(&lp.output_thread, NULL, local_output_main, NULL))
+		ERROR(SYSTEM, "pthread_create");
+}
+
+void
+local_deinit(void)
+{
+	pthread_mutex_lock(&lp.lock);
+	atomic_store(&lp.quit, true);
+	pthread_cond_signal(&lp.cond);
+	pthread_mutex_unlock(&lp.lock);
+
+	pthread_join(lp.decode_thread, NULL);
+	pthread_join(lp.output_thread, NULL);
+
+	if (lp.req_dec) lp.req_dec->close(lp.req_dec);
+
+	log_info("LOCAL: %u underruns\n", atomic_load(&lp.underruns));
+
+	pthread_mutex_destroy(&lp.lock);
+	pthread_cond_destroy(&lp.cond);
+	ring_deinit(&lp.ring);
+
+	player.underruns = -1;
+	player.latency_ms = -1;
+}
+
+void
+local_update(void)
+{
+	bool playing;
+	unsigned int rate;
+	uint64_t pos;
+
+	rate = atomic_load(&lp.rate);
+	pos = atomic_load(&lp.pos);
+	playing = atomic_load(&lp.serial) == lp.cur_serial && rate;
+
+	/* queue the next track shortly before the current one runs out,
+	 * so the decoder can continue without a gap */
+	if (player.loaded && playing && lp.advanced != lp.cur_serial
+			&& atomic_load(&lp.eof) == lp.cur_serial
+			&& pos + rate * LOCAL_ADVANCE_MS / 1000 >= lp.cur_frames) {
+		if (player_autoplay_next(true)) {
+			lp.advanced = lp.cur_serial;
+			lp.advancing = true;
+			player_next();
+			lp.advancing = false;
+		}
+	}
+
+	if (player.loaded && atomic_load(&lp.ended) == lp.cur_serial)
+		player.loaded = false;
+
+	if (!player.loaded) {
+		if (player_autoplay_next(player.track != NULL)) {
+			if (player_next() != PLAYER_OK)
+				local_clear_track();
+		} else if (player.track) {
+			local_clear_track();
+		}
+	}
+
+	if (atomic_exchange(&lp.sink_err, false))
+		PLAYER_STATUS("Failed to open %s output", lp.sink->name);
+
+	player.underruns = atomic_load(&lp.underruns);
+	player.latency_ms = atomic_load(&lp.latency_ms);
+
+	/* until the output reaches the new track show its start */
+	if (playing)
+		player.time_pos = pos / rate;
+}
+
+void
+local_request(struct local_dec *dec, bool gapless)
+{
+	pthread_mutex_lock(&lp.lock);
+	if (lp.req_dec) lp.req_dec->close(lp.req_dec);
+	lp.req_load = true;
+	lp.req_dec = dec;
+	lp.req_gapless = gapless;
+	lp.req_seek = -1;
+	lp.req_serial += 1;
+	lp.cur_serial = lp.req_serial;
+	pthread_cond_signal(&lp.cond);
+	pthread_mutex_unlock(&lp.lock);
+}
+
+int
+local_play_track(struct track *track, bool new)
+{
+	struct local_dec *dec;
+	unsigned int rate;
+	uint64_t frames;
+	bool gapless;
+
+	ASSERT(track != NULL);
+
+	dec = local_open(track->fpath);
+	if (!dec) {
+		local_clear_track();
+		player.track = track;
+		PLAYER_STATUS("Unsupported file: %s", track->name);
+		return PLAYER_ERR;
+	}
+
+	/* the decode thread owns the decoder after the request */
+	frames = dec->frames;
+	rate = dec->rate;
+
+	/* autoplay appends to the ending track without a gap */
+	gapless = lp.advancing && atomic_load(&lp.eof) == lp.cur_serial;
+	local_request(dec, gapless);
+
+	if (player.track)
+		player_add_history(player.track);
+	player.track = track;
+
+	/* new invocations are removed from history */
+	if (new) link_pop(&track->link_hs);
+
+	free(player.track_name);
+	player.track_name = astrdup(track->name);
+	player.loaded = true;
+	player.state = PLAYER_STATE_PLAYING;
+	atomic_store(&lp.paused, false);
+
+	lp.cur_rate = rate;
+	lp.cur_frames = frames;
+	player.time_pos = 0;
+	player.time_end = rate ? frames / rate : 0;
+
+	return PLAYER_OK;
+}
+
+int
+local_clear_track(void)
+{
+	/* nothing to append, let the current track finish */
+	if (lp.advancing)
+		return PLAYER_OK;
+
+	if (player.track)
+		player_add_history(player.track);
+
+	player.track = NULL;
+
+	local_request(NULL, false);
+
+	free(player.track_name);
+	player.track_name = NULL;
+	player.loaded = false;
+	player.time_pos = 0;
+	player.time_end = 0;
+
+	return PLAYER_OK;
+}
+
+int
+local_toggle_pause(void)
+{
+	if (player.state == PLAYER_STATE_PLAYING)
+		return local_pause();
+	else
+		return local_resume();
+}
+
+int
+local_pause(void)
+{
+	atomic_store(&lp.paused, true);
+	player.state = PLAYER_STATE_PAUSED;
+
+	return PLAYER_OK;
+}
+
+int
+local_resume(void)
+{
+	atomic_store(&lp.paused, false);
+	player.state = PLAYER_STATE_PLAYING;
+
+	return PLAYER_OK;
+}
+
+int
+local_play(void)
+{
+	if (!player.loaded && player.track)
+		return local_play_track(player.track, false);
+
+	return local_resume();
+}
+
+int
+local_stop(void)
+{
+	local_clear_track();
+
+	return PLAYER_OK;
+}
+
+int
+local_seek(int sec)
+{
+	unsigned int rate;
+
+	if (!player.loaded) {
+		PLAYER_STATUS("No track loaded");
+		return PLAYER_ERR;
+	}
+
+	/* the output may still be playing the previous track */
+	rate = lp.cur_rate;
+	if (!rate) return PLAYER_ERR;
+
+	sec = MIN(MAX(sec, 0), player.time_end);
+
+	/* decoder seeks and the output drops what is buffered */
+	pthread_mutex_lock(&lp.lock);
+	lp.req_seek = (int64_t) sec * rate;
+	pthread_cond_signal(&lp.cond);
+	pthread_mutex_unlock(&lp.lock);
+
+	player.time_pos = sec;
+
+	return PLAYER_OK;
+}
+
+int
+local_set_volume(unsigned int vol)
+{
+	atomic_store(&lp.volume, MIN(vol, 100));
+	player.volume = MIN(vol, 100);
+
+	return PLAYER_OK;
+}
+
+const struct player_backend player_backend_local = {
+	.name = "local",
+
+	.init = local_init,
+	.deinit = local_deinit,
+
+	.update = local_update,
+
+	.play_track = local_play_track,
+	.clear_track = local_clear_track,
+
+	.toggle_pause = local_toggle_pause,
+	.pause = local_pause,
+	.resume = local_resume,
+	.seek = local_seek,
+	.play = local_play,
+	.stop = local_stop,
+
+	.set_volume = local_set_volume,
+};
@@ -1,5 +1,6 @@
 #include "player.h"
 
+#include "tui.h"
 #include "data.h"
 #include "list.h"
 #include "util.h"
@@ -9,6 +10,7 @@
 #include <mpd/song.h>
 #include <mpd/status.h>
 
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -19,39 +21,66 @@
 struct mpd_player {
 	struct mpd_connection *conn;
 
-	/* number of frames to wait before unpausing after
-	 * seek to prevent pause-play cycle noises */
-	int seek_delay;
+	/* connection is waiting for idle events */
+	bool idle;
 
-	/* action to perform on next update */
-	int action;
+	/* start of the pending command list for latency logging */
+	uint64_t list_us;
+
+	/* elapsed time at last status refresh, used to
+	 * interpolate the position between idle events */
+	unsigned int elapsed_ms;
+	uint64_t update_ms;
 };
 
-struct player player;
-struct mpd_player mpd;
+static struct mpd_player mpd;
 
-static bool mpd_handle_status(int status);
+static bool mpd_handle_error(void);
 static char *mpd_loaded_track_name(struct mpd_song *song);
 
+static void mpd_reset(void);
+static bool mpd_idle_enter(void);
+static bool mpd_idle_leave(void);
+static bool mpd_refresh(void);
+
+static bool mpd_list_begin(void);
+static bool mpd_list_end(const char *action);
+
+static void mpd_init(void);
+static void mpd_deinit(void);
+static void mpd_update(void);
+static int mpd_play_track(struct track *track, bool new);
+static int mpd_clear_track(void);
+static int mpd_toggle_pause(void);
+static int mpd_pause(void);
+static int mpd_resume(void);
+static int mpd_play(void);
+static int mpd_stop(void);
+static int mpd_seek(int sec);
+static int mpd_set_volume(unsigned int vol);
+
 bool
-mpd_handle_status(int status)
+mpd_handle_error(void)
 {
 	const char *errstr;
 
-	switch (status) {
+	switch (mpd_connection_get_error(mpd.conn)) {
+	case MPD_ERROR_SUCCESS:
+		return true;
 	case MPD_ERROR_SERVER:
 	case MPD_ERROR_ARGUMENT:
-		if (!mpd_connection_clear_error(mpd.conn))
-			ERRORX(SYSTEM, "Player failed to recover");
-	case MPD_ERROR_SYSTEM:
 		errstr = mpd_connection_get_error_message(mpd.conn);
 		PLAYER_STATUS("MPD ERR - %s", errstr);
+		if (!mpd_connection_clear_error(mpd.conn))
+			ERRORX(SYSTEM, "Player failed to recover");
 		return false;
 	case MPD_ERROR_CLOSED:
 		ERRORX(SYSTEM, "Player connection abruptly closed");
+	default:
+		errstr = mpd_connection_get_error_message(mpd.conn);
+		PLAYER_STATUS("MPD ERR - %s", errstr);
+		return false;
 	}
-
-	return true;
 }
 
 char *
@@ -68,104 +97,106 @@ mpd_loaded_track_name(struct mpd_song *song)
 }
 
 void
-player_init(void)
+mpd_reset(void)
 {
+	PLAYER_STATUS("MPD connection reset: %s",
+		mpd_connection_get_error_message(mpd.conn));
+	mpd_connection_free(mpd.conn);
 	mpd.conn = NULL;
-	mpd.seek_delay = 0;
-
-	list_init(&player.playlist);
-	list_init(&player.history);
-	list_init(&player.queue);
+	mpd.idle = false;
+}
 
-	player.track = NULL;
-	player.track_name = NULL;
+bool
+mpd_idle_enter(void)
+{
+	enum mpd_idle mask;
 
-	player.loaded = 0;
-	player.autoplay = true;
-	player.shuffle = true;
+	if (mpd.idle) return true;
 
-	player.state = PLAYER_STATE_PAUSED;
-	player.volume = 50;
+	/* events which happened while we were not idle
+	 * are reported immediately by the server */
+	mask = MPD_IDLE_PLAYER | MPD_IDLE_MIXER | MPD_IDLE_PLAYLIST;
+	if (!mpd_send_idle_mask(mpd.conn, mask)) {
+		mpd_reset();
+		return false;
+	}
+	mpd.idle = true;
 
-	player.time_pos = 0;
-	player.time_end = 0;
+	return true;
 }
 
-void
-player_deinit(void)
+bool
+mpd_idle_leave(void)
 {
-	list_clear(&player.playlist);
-	list_clear(&player.queue);
-	list_clear(&player.history);
+	if (!mpd.conn) {
+		PLAYER_STATUS("MPD not connected");
+		return false;
+	}
 
-	free(player.status);
-	free(player.track_name);
+	if (!mpd.idle) return true;
 
-	if (mpd.conn) mpd_connection_free(mpd.conn);
+	/* pending events are still reported on next idle */
+	mpd.idle = false;
+	if (!mpd_run_noidle(mpd.conn)
+			&& mpd_connection_get_error(mpd.conn)) {
+		mpd_reset();
+		return false;
+	}
+
+	return true;
 }
 
-void
-player_update(void)
+bool
+mpd_refresh(void)
 {
 	struct mpd_status *status;
 	struct mpd_song *current_song;
-	bool queue_empty;
-
-	if (!mpd.conn) {
-		mpd.conn = mpd_connection_new(NULL, 0, 0);
-		if (!mpd.conn) ERRX("MPD connection failed");
+	bool was_loaded;
+
+	/* fetch status and current song in one round trip */
+	if (!mpd_command_list_begin(mpd.conn, true)
+			|| !mpd_send_status(mpd.conn)
+			|| !mpd_send_current_song(mpd.conn)
+			|| !mpd_command_list_end(mpd.conn)) {
+		mpd_reset();
+		return false;
 	}
 
-	status = mpd_run_status(mpd.conn);
+	status = mpd_recv_status(mpd.conn);
 	if (!status) {
-		PLAYER_STATUS("MPD connection reset: %s",
-			mpd_connection_get_error_message(mpd.conn));
-		mpd_connection_free(mpd.conn);
-		mpd.conn = NULL;
-		return;
+		mpd_reset();
+		return false;
 	}
 
-	current_song = mpd_run_current_song(mpd.conn);
-	if (!current_song) {
-		if (player.track)
-			player_add_history(player.track);
+	current_song = NULL;
+	if (mpd_response_next(mpd.conn))
+		current_song = mpd_recv_song(mpd.conn);
 
-		queue_empty = list_empty(&player.queue);
-		if (player.loaded && player.autoplay || !queue_empty)
-			player_next();
-	} else {
-		mpd_song_free(current_song);
+	if (!mpd_response_finish(mpd.conn)) {
+		if (current_song) mpd_song_free(current_song);
+		mpd_status_free(status);
+		mpd_reset();
+		return false;
 	}
 
-	mpd_status_free(status);
-
-	/* in case autoplay loaded new track,
-	 * get status and track name again.. */
-	status = mpd_run_status(mpd.conn);
-	if (!status) {
-		PLAYER_STATUS("MPD connection reset: %s",
-			mpd_connection_get_error_message(mpd.conn));
-		mpd_connection_free(mpd.conn);
-		mpd.conn = NULL;
-		return;
-	}
+	was_loaded = player.loaded;
 
-	current_song = mpd_run_current_song(mpd.conn);
+	free(player.track_name);
 	if (current_song) {
-		free(player.track_name);
 		player.track_name = mpd_loaded_track_name(current_song);
 		player.loaded = true;
-		player.time_pos = mpd_status_get_elapsed_time(status);
 		player.time_end = mpd_song_get_duration(current_song);
 		mpd_song_free(current_song);
 	} else {
-		free(player.track_name);
 		player.track_name = NULL;
 		player.loaded = false;
-		player.time_pos = 0;
 		player.time_end = 0;
 	}
 
+	mpd.elapsed_ms = mpd_status_get_elapsed_ms(status);
+	mpd.update_ms = current_ms();
+	player.time_pos = mpd.elapsed_ms / 1000;
+
 	switch (mpd_status_get_state(status)) {
 	case MPD_STATE_PAUSE:
 		player.state = PLAYER_STATE_PAUSED;
@@ -174,39 +205,142 @@ player_update(void)
 		player.state = PLAYER_STATE_PLAYING;
 		break;
 	case MPD_STATE_STOP:
+	default:
 		player.state = PLAYER_STATE_STOPPED;
 		break;
-	default:
-		ASSERT(0);
 	}
 
 	player.volume = mpd_status_get_volume(status);
 
-	if (mpd.seek_delay) {
-		mpd.seek_delay -= 1;
-		if (!mpd.seek_delay) player_play();
+	mpd_status_free(status);
+
+	if (!current_song) {
+		if (player.track)
+			player_add_history(player.track);
+
+		/* state is refreshed again by the resulting event */
+		if (player_autoplay_next(was_loaded))
+			player_next();
 	}
 
-	mpd_status_free(status);
+	return true;
 }
 
-int
-player_play_track(struct track *track, bool new)
+bool
+mpd_list_begin(void)
 {
-	int status;
+	if (!mpd_idle_leave())
+		return false;
+
+	mpd.list_us = current_us();
 
+	/* commands are queued until mpd_list_end and
+	 * sent to the server in a single round trip */
+	if (!mpd_command_list_begin(mpd.conn, false)) {
+		mpd_handle_error();
+		return false;
+	}
+
+	return true;
+}
+
+bool
+mpd_list_end(const char *action)
+{
+	if (!mpd_command_list_end(mpd.conn)
+			|| !mpd_response_finish(mpd.conn)) {
+		mpd_handle_error();
+		return false;
+	}
+
+	/* per action latency with TMUS_LOG, see bench/mpd.c */
+	log_info("MPD: %s took %lu us\n", action,
+		current_us() - mpd.list_us);
+
+	return true;
+}
+
+void
+mpd_init(void)
+{
+	mpd.conn = NULL;
+	mpd.idle = false;
+	mpd.list_us = 0;
+	mpd.elapsed_ms = 0;
+	mpd.update_ms = 0;
+}
+
+void
+mpd_deinit(void)
+{
+	if (mpd.conn) mpd_connection_free(mpd.conn);
+	mpd.conn = NULL;
+}
+
+void
+mpd_update(void)
+{
+	struct pollfd pfd;
+	enum mpd_idle events;
+	uint64_t elapsed;
+
+	if (!mpd.conn) {
+		mpd.conn = mpd_connection_new(NULL, 0, 0);
+		if (!mpd.conn) ERRORX(SYSTEM, "MPD connection failed");
+		if (mpd_connection_get_error(mpd.conn)) {
+			mpd_reset();
+			return;
+		}
+
+		if (!mpd_refresh()) return;
+		mpd_idle_enter();
+		return;
+	}
+
+	if (mpd.idle) {
+		/* only talk to the server when it notified us */
+		pfd.fd = mpd_connection_get_fd(mpd.conn);
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) > 0) {
+			mpd.idle = false;
+			events = mpd_recv_idle(mpd.conn, false);
+			if (!events && mpd_connection_get_error(mpd.conn)) {
+				mpd_reset();
+				return;
+			}
+			if (!mpd_refresh()) return;
+		}
+	} else {
+		/* commands were sent since the last update */
+		if (!mpd_refresh()) return;
+	}
+
+	if (!mpd_idle_enter()) return;
+
+	if (player.state == PLAYER_STATE_PLAYING) {
+		elapsed = mpd.elapsed_ms + current_ms() - mpd.update_ms;
+		player.time_pos = elapsed / 1000;
+		if (player.time_end)
+			player.time_pos = MIN(player.time_pos, player.time_end);
+	}
+}
+
+int
+mpd_play_track(struct track *track, bool new)
+{
 	ASSERT(track != NULL);
 
-	status = mpd_run_clear(mpd.conn);
-	if (!mpd_handle_status(status))
+	if (!mpd_list_begin())
 		return PLAYER_ERR;
 
-	status = mpd_run_add(mpd.conn, track->fpath);
-	if (!mpd_handle_status(status))
+	if (!mpd_send_clear(mpd.conn)
+			|| !mpd_send_add(mpd.conn, track->fpath)
+			|| !mpd_send_play(mpd.conn)) {
+		mpd_handle_error();
 		return PLAYER_ERR;
+	}
 
-	status = mpd_run_play(mpd.conn);
-	if (!mpd_handle_status(status))
+	if (!mpd_list_end("play track"))
 		return PLAYER_ERR;
 
 	/* add last track to history */
@@ -222,114 +356,141 @@ player_play_track(struct track *track, bool new)
 }
 
 int
-player_clear_track(void)
+mpd_clear_track(void)
 {
-	int status;
-
 	player.track = NULL;
-	status = mpd_run_clear(mpd.conn);
 
-	if (!mpd_handle_status(status))
+	if (!mpd_idle_leave())
+		return PLAYER_ERR;
+
+	if (!mpd_run_clear(mpd.conn) && !mpd_handle_error())
 		return PLAYER_ERR;
 
 	return PLAYER_OK;
 }
 
 int
-player_toggle_pause(void)
+mpd_toggle_pause(void)
 {
-	int status;
+	if (!mpd_idle_leave())
+		return PLAYER_ERR;
 
-	status = mpd_run_toggle_pause(mpd.conn);
-	if (!mpd_handle_status(status))
+	if (!mpd_run_toggle_pause(mpd.conn) && !mpd_handle_error())
 		return PLAYER_ERR;
 
 	return PLAYER_OK;
 }
 
 int
-player_pause(void)
+mpd_pause(void)
 {
-	int status;
+	if (!mpd_idle_leave())
+		return PLAYER_ERR;
 
-	status = mpd_run_pause(mpd.conn, true);
-	if (!mpd_handle_status(status))
+	if (!mpd_run_pause(mpd.conn, true) && !mpd_handle_error())
 		return PLAYER_ERR;
 
 	return PLAYER_OK;
 }
 
 int
-player_resume(void)
+mpd_resume(void)
 {
-	int status;
+	if (!mpd_idle_leave())
+		return PLAYER_ERR;
 
-	status = mpd_run_pause(mpd.conn, false);
-	if (!mpd_handle_status(status))
+	if (!mpd_run_pause(mpd.conn, false) && !mpd_handle_error())
 		return PLAYER_ERR;
 
 	return PLAYER_OK;
 }
 
 int
-player_play(void)
+mpd_play(void)
 {
-	int status;
+	if (!mpd_idle_leave())
+		return PLAYER_ERR;
 
-	status = mpd_run_play(mpd.conn);
-	if (!mpd_handle_status(status))
+	if (!mpd_run_play(mpd.conn) && !mpd_handle_error())
 		return PLAYER_ERR;
 
 	return PLAYER_OK;
 }
 
 int
-player_stop(void)
+mpd_stop(void)
 {
-	int status;
+	if (!mpd_idle_leave())
+		return PLAYER_ERR;
 
-	status = mpd_run_stop(mpd.conn);
-	if (!mpd_handle_status(status))
+	if (!mpd_run_stop(mpd.conn) && !mpd_handle_error())
 		return PLAYER_ERR;
 
 	return PLAYER_OK;
 }
 
 int
-player_seek(int sec)
+mpd_seek(int sec)
 {
-	int status;
-
 	if (!player.loaded || player.state == PLAYER_STATE_STOPPED) {
 		PLAYER_STATUS("No track loaded");
 		return PLAYER_ERR;
 	}
 
-	status = mpd_run_seek_current(mpd.conn, sec, false);
-	if (!mpd_handle_status(status))
+	/* seekcur keeps the playback state, no need to pause */
+	if (!mpd_list_begin())
+		return PLAYER_ERR;
+
+	if (!mpd_send_seek_current(mpd.conn, MAX(sec, 0), false)) {
+		mpd_handle_error();
+		return PLAYER_ERR;
+	}
+
+	if (!mpd_list_end("seek"))
 		return PLAYER_ERR;
 
-	mpd.seek_delay = 7;
-	player_pause();
+	mpd.elapsed_ms = MAX(sec, 0) * 1000U;
+	mpd.update_ms = current_ms();
+	player.time_pos = MAX(sec, 0);
 
 	return PLAYER_OK;
 }
 
 int
-player_set_volume(unsigned int vol)
+mpd_set_volume(unsigned int vol)
 {
-	int status;
-
 	if (player.volume == -1) {
 		PLAYER_STATUS("Volume control not supported");
 		return PLAYER_ERR;
 	}
 
-	status = mpd_run_set_volume(mpd.conn, vol);
-	if (!mpd_handle_status(status))
+	if (!mpd_idle_leave())
+		return PLAYER_ERR;
+
+	if (!mpd_run_set_volume(mpd.conn, vol) && !mpd_handle_error())
 		return PLAYER_ERR;
 	player.volume = vol;
 
 	return PLAYER_OK;
 }
 
+const struct player_backend player_backend_mpd = {
+	.name = "mpd",
+
+	.init = mpd_init,
+	.deinit = mpd_deinit,
+
+	.update = mpd_update,
+
+	.play_track = mpd_play_track,
+	.clear_track = mpd_clear_track,
+
+	.toggle_pause = mpd_toggle_pause,
+	.pause = mpd_pause,
+	.resume = mpd_resume,
+	.seek = mpd_seek,
+	.play = mpd_play,
+	.stop = mpd_stop,
+
+	.set_volume = mpd_set_volume,
+};
@@ -5,6 +5,7 @@
 #include "list.h"
 #include "util.h"
 #include "log.h"
+#include "meta.h"
 
 #include <sys/wait.h>
 #include <sys/mman.h>
@@ -30,8 +31,7 @@ struct mplay_player {
 	uint64_t update_ms;
 };
 
-struct player player;
-struct mplay_player mplay;
+static struct mplay_player mplay;
 
 static void sigpipe_handler(int sig);
 
@@ -39,6 +39,19 @@ static void mplay_kill(void);
 static bool mplay_run(struct track *track);
 static char *mplay_readline(void);
 
+static void mplay_init(void);
+static void mplay_deinit(void);
+static void mplay_update(void);
+static int mplay_play_track(struct track *track, bool new);
+static int mplay_clear_track(void);
+static int mplay_toggle_pause(void);
+static int mplay_pause(void);
+static int mplay_resume(void);
+static int mplay_play(void);
+static int mplay_stop(void);
+static int mplay_seek(int sec);
+static int mplay_set_volume(unsigned int vol);
+
 void
 sigpipe_handler(int sig)
 {
@@ -131,53 +144,30 @@ mplay_readline(void)
 }
 
 void
-player_init(void)
+mplay_init(void)
 {
-	list_init(&player.playlist);
-	list_init(&player.history);
-	list_init(&player.queue);
-
-	player.track = NULL;
-	player.track_name = NULL;
-
-	player.loaded = false;
-	player.autoplay = true;
-	player.shuffle = true;
-
-	player.state = PLAYER_STATE_PAUSED;
-	player.volume = 50;
-
-	player.time_pos = 0;
-	player.time_end = 0;
-
 	signal(SIGPIPE, sigpipe_handler);
 }
 
 void
-player_deinit(void)
+mplay_deinit(void)
 {
-	list_clear(&player.playlist);
-	list_clear(&player.queue);
-	list_clear(&player.history);
-
-	free(player.track_name);
-
 	mplay_kill();
+
+	signal(SIGPIPE, SIG_DFL);
 }
 
 void
-player_update(void)
+mplay_update(void)
 {
-	bool queue_empty;
 	char *tok, *line;
 
 	if (!player.loaded) {
-		queue_empty = list_empty(&player.queue);
-		if (player.track && player.autoplay || !queue_empty) {
+		if (player_autoplay_next(player.track != NULL)) {
 			if (player_next() != PLAYER_OK)
-				player_clear_track();
+				mplay_clear_track();
 		} else if (player.track) {
-			player_clear_track();
+			mplay_clear_track();
 		}
 	}
 
@@ -211,11 +201,13 @@ player_update(void)
 }
 
 int
-player_play_track(struct track *track, bool new)
+mplay_play_track(struct track *track, bool new)
 {
+	struct meta *meta;
+
 	ASSERT(track != NULL);
 
-	player_clear_track();
+	mplay_clear_track();
 	player.track = track;
 
 	if (!mplay_run(track))
@@ -224,14 +216,16 @@ player_play_track(struct track *track, bool new)
 	/* new invocations are removed from history */
 	if (new) link_pop(&track->link_hs);
 
+	/* mplay only reports positions, start from the scanned length */
 	player.time_pos = 0;
-	player.time_end = 0;
+	meta = meta_get(track);
+	player.time_end = meta ? meta->duration / 1000 : 0;
 
 	return PLAYER_OK;
 }
 
 int
-player_clear_track(void)
+mplay_clear_track(void)
 {
 	if (player.track)
 		player_add_history(player.track);
@@ -243,7 +237,7 @@ player_clear_track(void)
 }
 
 int
-player_toggle_pause(void)
+mplay_toggle_pause(void)
 {
 	char *line;
 
@@ -259,39 +253,39 @@ player_toggle_pause(void)
 }
 
 int
-player_pause(void)
+mplay_pause(void)
 {
 	if (player.state != PLAYER_STATE_PAUSED)
-		player_toggle_pause();
+		mplay_toggle_pause();
 
 	return PLAYER_OK;
 }
 
 int
-player_resume(void)
+mplay_resume(void)
 {
 	if (player.state != PLAYER_STATE_PLAYING)
-		player_toggle_pause();
+		mplay_toggle_pause();
 
 	return PLAYER_OK;
 }
 
 int
-player_play(void)
+mplay_play(void)
 {
 	return PLAYER_OK;
 }
 
 int
-player_stop(void)
+mplay_stop(void)
 {
-	player_clear_track();
+	mplay_clear_track();
 
 	return PLAYER_OK;
 }
 
 int
-player_seek(int sec)
+mplay_seek(int sec)
 {
 	char *line;
 
@@ -312,7 +306,7 @@ player_seek(int sec)
 }
 
 int
-player_set_volume(unsigned int vol)
+mplay_set_volume(unsigned int vol)
 {
 	char *line;
 
@@ -334,3 +328,23 @@ player_set_volume(unsigned int vol)
 	return PLAYER_OK;
 }
 
+const struct player_backend player_backend_mplay = {
+	.name = "mplay",
+
+	.init = mplay_init,
+	.deinit = mplay_deinit,
+
+	.update = mplay_update,
+
+	.play_track = mplay_play_track,
+	.clear_track = mplay_clear_track,
+
+	.toggle_pause = mplay_toggle_pause,
+	.pause = mplay_pause,
+	.resume = mplay_resume,
+	.seek = mplay_seek,
+	.play = mplay_play,
+	.stop = mplay_stop,
+
+	.set_volume = mplay_set_volume,
+};
@@ -0,0 +1,326 @@
+#include "player.h"
+
+#include "tui.h"
+#include "data.h"
+#include "list.h"
+#include "util.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct sim_player {
+	/* virtual clock and real time it was last advanced */
+	uint64_t clock_ms;
+	uint64_t real_ms;
+
+	/* virtual ms per real ms, 0 for manual advance only */
+	unsigned int speed;
+
+	/* delay added to each command in us */
+	unsigned int latency_us;
+
+	/* chance of a command failing in percent */
+	unsigned int fail_pct;
+
+	/* mean length of simulated tracks in seconds */
+	unsigned int track_len;
+
+	/* position inside the loaded track */
+	uint64_t pos_ms;
+
+	/* counters for benchmarks */
+	unsigned long transitions;
+	unsigned long failures;
+};
+
+static struct sim_player sim;
+
+static unsigned int sim_env(const char *name, unsigned int fallback);
+static bool sim_command(void);
+static unsigned int sim_track_len(struct track *track);
+static void sim_autoplay(void);
+static void sim_tick(uint64_t delta);
+
+static void sim_init(void);
+static void sim_deinit(void);
+static void sim_update(void);
+static int sim_play_track(struct track *track, bool new);
+static int sim_clear_track(void);
+static int sim_toggle_pause(void);
+static int sim_pause(void);
+static int sim_resume(void);
+static int sim_play(void);
+static int sim_stop(void);
+static int sim_seek(int sec);
+static int sim_set_volume(unsigned int vol);
+
+unsigned int
+sim_env(const char *name, unsigned int fallback)
+{
+	const char *envstr;
+
+	envstr = getenv(name);
+	if (!envstr) return fallback;
+
+	return strtoul(envstr, NULL, 10);
+}
+
+bool
+sim_command(void)
+{
+	if (sim.latency_us)
+		usleep(sim.latency_us);
+
+	if (sim.fail_pct && rand() % 100 < sim.fail_pct) {
+		sim.failures += 1;
+		PLAYER_STATUS("Simulated failure");
+		return false;
+	}
+
+	return true;
+}
+
+unsigned int
+sim_track_len(struct track *track)
+{
+	unsigned int hash;
+	const char *c;
+
+	/* stable pseudo-random length between 0.5x and 1.5x */
+	hash = 5381;
+	for (c = track->name; *c; c++)
+		hash = hash * 33 + (unsigned char) *c;
+
+	return MAX(1, sim.track_len / 2 + hash % MAX(1, sim.track_len));
+}
+
+void
+sim_autoplay(void)
+{
+	if (player_autoplay_next(player.track != NULL)) {
+		if (player_next() != PLAYER_OK)
+			sim_clear_track();
+	} else if (player.track) {
+		sim_clear_track();
+	}
+}
+
+void
+sim_tick(uint64_t delta)
+{
+	uint64_t left;
+
+	sim.clock_ms += delta;
+
+	/* a large step may span multiple track transitions */
+	while (true) {
+		if (!player.loaded) {
+			sim_autoplay();
+			if (!player.loaded) break;
+		}
+
+		if (player.state != PLAYER_STATE_PLAYING || !delta)
+			break;
+
+		left = player.time_end * 1000UL - sim.pos_ms;
+		if (delta < left) {
+			sim.pos_ms += delta;
+			break;
+		}
+
+		delta -= left;
+		sim.pos_ms = 0;
+		sim.transitions += 1;
+		player.loaded = false;
+	}
+
+	player.time_pos = sim.pos_ms / 1000;
+}
+
+void
+sim_init(void)
+{
+	sim.speed = sim_env("TMUS_SIM_SPEED", 1000);
+	sim.latency_us = sim_env("TMUS_SIM_LATENCY", 0);
+	sim.fail_pct = sim_env("TMUS_SIM_FAIL", 0);
+	sim.track_len = sim_env("TMUS_SIM_LEN", 180);
+
+	sim.clock_ms = 0;
+	sim.real_ms = current_ms();
+	sim.pos_ms = 0;
+
+	sim.transitions = 0;
+	sim.failures = 0;
+}
+
+void
+sim_deinit(void)
+{
+	log_info("SIM: %lu transitions, %lu failures in %lu ms\n",
+		sim.transitions, sim.failures, sim.clock_ms);
+}
+
+void
+sim_update(void)
+{
+	uint64_t now;
+
+	now = current_ms();
+	sim_tick((now - sim.real_ms) * sim.speed);
+	sim.real_ms = now;
+}
+
+int
+sim_play_track(struct track *track, bool new)
+{
+	ASSERT(track != NULL);
+
+	sim_clear_track();
+	player.track = track;
+
+	if (!sim_command())
+		return PLAYER_ERR;
+
+	/* new invocations are removed from history */
+	if (new) link_pop(&track->link_hs);
+
+	free(player.track_name);
+	player.track_name = astrdup(track->name);
+	player.loaded = true;
+	player.state = PLAYER_STATE_PLAYING;
+
+	sim.pos_ms = 0;
+	player.time_pos = 0;
+	player.time_end = sim_track_len(track);
+
+	return PLAYER_OK;
+}
+
+int
+sim_clear_track(void)
+{
+	if (player.track)
+		player_add_history(player.track);
+
+	player.track = NULL;
+	player.loaded = false;
+
+	free(player.track_name);
+	player.track_name = NULL;
+
+	sim.pos_ms = 0;
+	player.time_pos = 0;
+	player.time_end = 0;
+
+	return PLAYER_OK;
+}
+
+int
+sim_toggle_pause(void)
+{
+	if (!sim_command())
+		return PLAYER_ERR;
+
+	if (player.state == PLAYER_STATE_PLAYING)
+		player.state = PLAYER_STATE_PAUSED;
+	else if (player.state == PLAYER_STATE_PAUSED)
+		player.state = PLAYER_STATE_PLAYING;
+
+	return PLAYER_OK;
+}
+
+int
+sim_pause(void)
+{
+	if (player.state != PLAYER_STATE_PAUSED)
+		return sim_toggle_pause();
+
+	return PLAYER_OK;
+}
+
+int
+sim_resume(void)
+{
+	if (player.state != PLAYER_STATE_PLAYING)
+		return sim_toggle_pause();
+
+	return PLAYER_OK;
+}
+
+int
+sim_play(void)
+{
+	return PLAYER_OK;
+}
+
+int
+sim_stop(void)
+{
+	sim_clear_track();
+
+	return PLAYER_OK;
+}
+
+int
+sim_seek(int sec)
+{
+	if (!player.loaded) {
+		PLAYER_STATUS("No track loaded");
+		return PLAYER_ERR;
+	}
+
+	if (!sim_command())
+		return PLAYER_ERR;
+
+	sim.pos_ms = MIN(MAX(sec, 0), player.time_end) * 1000UL;
+	player.time_pos = sim.pos_ms / 1000;
+
+	return PLAYER_OK;
+}
+
+int
+sim_set_volume(unsigned int vol)
+{
+	if (!sim_command())
+		return PLAYER_ERR;
+
+	player.volume = vol;
+
+	return PLAYER_OK;
+}
+
+void
+player_sim_advance(unsigned int ms)
+{
+	sim_tick(ms);
+}
+
+unsigned long
+player_sim_transitions(void)
+{
+	return sim.transitions;
+}
+
+const struct player_backend player_backend_sim = {
+	.name = "sim",
+
+	.init = sim_init,
+	.deinit = sim_deinit,
+
+	.update = sim_update,
+
+	.play_track = sim_play_track,
+	.clear_track = sim_clear_track,
+
+	.toggle_pause = sim_toggle_pause,
+	.pause = sim_pause,
+	.resume = sim_resume,
+	.seek = sim_seek,
+	.play = sim_play,
+	.stop = sim_stop,
+
+	.set_volume = sim_set_volume,
+};
@@ -0,0 +1,96 @@
+#include "ring.h"
+
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void
+ring_init(struct ring *ring, size_t size)
+{
+	/* power of two so positions can be masked */
+	ASSERT(size && !(size & (size - 1)));
+
+	ring->buf = malloc(size);
+	if (!ring->buf) ERROR(SYSTEM, "malloc");
+	ring->size = size;
+
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+}
+
+void
+ring_deinit(struct ring *ring)
+{
+	free(ring->buf);
+}
+
+size_t
+ring_space(struct ring *ring)
+{
+	size_t head, tail;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	return ring->size - (head - tail);
+}
+
+size_t
+ring_avail(struct ring *ring)
+{
+	size_t head, tail;
+
+	head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	return head - tail;
+}
+
+size_t
+ring_write(struct ring *ring, const void *data, size_t len)
+{
+	size_t head, off, part;
+
+	len = MIN(len, ring_space(ring));
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	off = head & (ring->size - 1);
+	part = MIN(len, ring->size - off);
+	memcpy(ring->buf + off, data, part);
+	memcpy(ring->buf, (const char *) data + part, len - part);
+
+	/* publish data before the new head */
+	atomic_store_explicit(&ring->head, head + len, memory_order_release);
+
+	return len;
+}
+
+size_t
+ring_read(struct ring *ring, void *data, size_t len)
+{
+	size_t tail, off, part;
+
+	len = MIN(len, ring_avail(ring));
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	off = tail & (ring->size - 1);
+	part = MIN(len, ring->size - off);
+	memcpy(data, ring->buf + off, part);
+	memcpy((char *) data + part, ring->buf, len - part);
+
+	/* release the space only after copying out */
+	atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+
+	return len;
+}
+
+void
+ring_skip_to(struct ring *ring, size_t pos)
+{
+	size_t head;
+
+	/* only the consumer may drop data */
+	head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	atomic_store_explicit(&ring->tail, MIN(pos, head), memory_order_release);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* lock-free single-producer single-consumer byte ring,
+ * positions count bytes ever written / read */
+struct ring {
+	char *buf;
+	size_t size;
+
+	_Atomic size_t head; /* producer */
+	_Atomic size_t tail; /* consumer */
+};
+
+void ring_init(struct ring *ring, size_t size);
+void ring_deinit(struct ring *ring);
+
+size_t ring_space(struct ring *ring);
+size_t ring_avail(struct ring *ring);
+
+size_t ring_write(struct ring *ring, const void *data, size_t len);
+size_t ring_read(struct ring *ring, void *data, size_t len);
+void ring_skip_to(struct ring *ring, size_t pos);
@@ -0,0 +1,357 @@
+#include "session.h"
+
+#include "data.h"
+#include "list.h"
+#include "listnav.h"
+#include "log.h"
+#include "player.h"
+#include "tui.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SESSION_MAGIC "TMUSSESS"
+#define SESSION_VERSION 2
+
+/* periodic save, so a crash loses little */
+#define SESSION_SAVE_MS 30000
+
+enum {
+	SESSION_AUTOPLAY = 1 << 0,
+	SESSION_SHUFFLE = 1 << 1,
+	SESSION_PLAYLIST = 1 << 2
+};
+
+struct session_buf {
+	uint8_t *data;
+	size_t len, cap;
+};
+
+struct session_rd {
+	const uint8_t *p, *end;
+	bool err;
+};
+
+static void put_bytes(struct session_buf *buf, const void *data, size_t len);
+static void put_u32(struct session_buf *buf, uint32_t v);
+static void put_u64(struct session_buf *buf, uint64_t v);
+static void put_str(struct session_buf *buf, const char *str);
+static void put_nav(struct session_buf *buf, struct listnav *nav);
+
+static uint32_t get_u32(struct session_rd *rd);
+static uint64_t get_u64(struct session_rd *rd);
+static const char *get_str(struct session_rd *rd);
+static uint32_t get_count(struct session_rd *rd, size_t size);
+static void get_nav(struct session_rd *rd, struct listnav *nav,
+	int len, int wlen);
+
+static bool session_active;
+static uint64_t session_saved;
+
+void
+put_bytes(struct session_buf *buf, const void *data, size_t len)
+{
+	if (buf->len + len > buf->cap) {
+		buf->cap = MAX(buf->cap * 2, buf->len + len);
+		buf->data = realloc(buf->data, buf->cap);
+		if (!buf->data) ERROR(SYSTEM, "realloc");
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+void
+put_u32(struct session_buf *buf, uint32_t v)
+{
+	uint8_t p[4];
+
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+	put_bytes(buf, p, 4);
+}
+
+void
+put_u64(struct session_buf *buf, uint64_t v)
+{
+	put_u32(buf, v);
+	put_u32(buf, v >> 32);
+}
+
+void
+put_str(struct session_buf *buf, const char *str)
+{
+	put_bytes(buf, str, strlen(str) + 1);
+}
+
+void
+put_nav(struct session_buf *buf, struct listnav *nav)
+{
+	put_u32(buf, nav->sel);
+	put_u32(buf, nav->wmax);
+}
+
+uint32_t
+get_u32(struct session_rd *rd)
+{
+	const uint8_t *p;
+
+	if (rd->end - rd->p < 4) {
+		rd->err = true;
+		return 0;
+	}
+
+	p = rd->p;
+	rd->p += 4;
+
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+uint64_t
+get_u64(struct session_rd *rd)
+{
+	uint64_t v;
+
+	v = get_u32(rd);
+	v |= (uint64_t) get_u32(rd) << 32;
+
+	return v;
+}
+
+const char *
+get_str(struct session_rd *rd)
+{
+	const char *str;
+	const uint8_t *nul;
+
+	nul = memchr(rd->p, '\0', rd->end - rd->p);
+	if (!nul) {
+		rd->err = true;
+		return "";
+	}
+
+	str = (const char *) rd->p;
+	rd->p = nul + 1;
+
+	return str;
+}
+
+uint32_t
+get_count(struct session_rd *rd, size_t size)
+{
+	uint32_t n;
+
+	/* a count the rest of the file cannot hold is corrupt */
+	n = get_u32(rd);
+	if (n > (size_t) (rd->end - rd->p) / size) {
+		rd->err = true;
+		return 0;
+	}
+
+	return n;
+}
+
+void
+get_nav(struct session_rd *rd, struct listnav *nav, int len, int wlen)
+{
+	int sel, wmax;
+
+	sel = get_u32(rd);
+	wmax = get_u32(rd);
+	if (rd->err) return;
+
+	/* the window is derived from wmax, sel is kept inside it */
+	nav->sel = sel;
+	nav->wmax = wmax;
+	nav->wlen = wlen;
+	listnav_update_bounds(nav, 0, len);
+}
+
+void
+session_load(void)
+{
+	struct session_rd rd;
+	struct track *current, *track;
+	struct tag *tag;
+	struct link *link;
+	uint32_t flags, state, pos, i, n;
+	struct stat st;
+	uint8_t *data;
+	char *path;
+	FILE *file;
+	int len;
+
+	/* recordings replay against a fresh session */
+	session_active = !getenv("TMUS_REPLAY");
+	session_saved = current_ms();
+	if (!session_active) return;
+
+	path = aprintf("%s/.session", datadir);
+	file = fopen(path, "r");
+	free(path);
+	if (!file) return;
+
+	data = NULL;
+	if (fstat(fileno(file), &st) || st.st_size < 12)
+		goto cleanup;
+
+	data = malloc(st.st_size);
+	if (!data) ERROR(SYSTEM, "malloc");
+	if (fread(data, 1, st.st_size, file) != st.st_size)
+		goto cleanup;
+
+	rd.p = data;
+	rd.end = data + st.st_size;
+	rd.err = false;
+
+	if (memcmp(rd.p, SESSION_MAGIC, 8))
+		goto cleanup;
+	rd.p += 8;
+	if (get_u32(&rd) != SESSION_VERSION)
+		goto cleanup;
+
+	flags = get_u32(&rd);
+	state = get_u32(&rd);
+	pos = get_u32(&rd);
+	if (rd.err) goto cleanup;
+
+	player.autoplay = flags & SESSION_AUTOPLAY;
+	player.shuffle = flags & SESSION_SHUFFLE;
+	track_show_playlist = !!(flags & SESSION_PLAYLIST);
+
+	n = get_count(&rd, 1);
+	for (i = 0; i < n && !rd.err; i++) {
+		tag = tag_find(get_str(&rd));
+		if (tag && !link_inuse(&tag->link_sel))
+			list_push_back(&tags_sel, &tag->link_sel);
+	}
+	playlist_outdated = true;
+	playlist_update();
+
+	get_nav(&rd, &tag_nav, olist_len(&tags), tag_pane->h - 1);
+	if (track_show_playlist) {
+		len = olist_len(&player.playlist);
+	} else {
+		link = olist_at(&tags, tag_nav.sel);
+		tag = link ? UPCAST(link, struct tag, link.link) : NULL;
+		len = tag ? olist_len(&tag->tracks) : 0;
+	}
+	get_nav(&rd, &track_nav, len, track_pane->h - 1);
+
+	/* tracks by id, gone ones are skipped */
+	current = track_find_id(get_u64(&rd));
+
+	n = get_count(&rd, 8);
+	for (i = 0; i < n; i++) {
+		track = track_find_id(get_u64(&rd));
+		if (track) player_queue_push(track);
+	}
+
+	n = get_count(&rd, 8);
+	for (i = 0; i < n; i++) {
+		track = track_find_id(get_u64(&rd));
+		if (track) player_add_history(track);
+	}
+
+	/* resume where playback stopped */
+	if (current && (state == PLAYER_STATE_PLAYING
+			|| state == PLAYER_STATE_PAUSED)) {
+		if (player_play_track(current, false) == PLAYER_OK) {
+			if (pos) player_seek(pos);
+			if (state == PLAYER_STATE_PAUSED)
+				player_pause();
+		}
+	} else if (current) {
+		player.track = current;
+	}
+
+	tui_damage(DAMAGE_ALL);
+
+cleanup:
+	free(data);
+	fclose(file);
+}
+
+void
+session_save(void)
+{
+	struct session_buf buf;
+	struct track *track;
+	struct link *link;
+	struct tag *tag;
+	char *path, *tmp;
+	uint32_t flags;
+	FILE *file;
+	bool ok;
+
+	if (!session_active) return;
+	session_saved = current_ms();
+
+	memset(&buf, 0, sizeof(buf));
+	put_bytes(&buf, SESSION_MAGIC, 8);
+	put_u32(&buf, SESSION_VERSION);
+
+	flags = 0;
+	if (player.autoplay) flags |= SESSION_AUTOPLAY;
+	if (player.shuffle) flags |= SESSION_SHUFFLE;
+	if (track_show_playlist) flags |= SESSION_PLAYLIST;
+	put_u32(&buf, flags);
+	put_u32(&buf, player.loaded ? player.state : PLAYER_STATE_NONE);
+	put_u32(&buf, player.time_pos);
+
+	put_u32(&buf, list_len(&tags_sel));
+	for (LIST_ITER(&tags_sel, link)) {
+		tag = UPCAST(link, struct tag, link_sel);
+		put_str(&buf, tag->name);
+	}
+
+	put_nav(&buf, &tag_nav);
+	put_nav(&buf, &track_nav);
+
+	put_u64(&buf, player.track ? player.track->id : 0);
+
+	put_u32(&buf, player.queue_stats.count);
+	for (LIST_ITER(&player.queue, link)) {
+		track = UPCAST(link, struct track, link_pq);
+		put_u64(&buf, track->id);
+	}
+
+	put_u32(&buf, list_len(&player.history));
+	for (LIST_ITER(&player.history, link)) {
+		track = UPCAST(link, struct track, link_hs);
+		put_u64(&buf, track->id);
+	}
+
+	path = aprintf("%s/.session", datadir);
+	tmp = aprintf("%s/.session.tmp", datadir);
+
+	/* replaced in one step, a crash leaves the previous session */
+	file = fopen(tmp, "w");
+	if (file) {
+		ok = fwrite(buf.data, 1, buf.len, file) == buf.len;
+		ok = !fflush(file) && ok;
+		ok = !fdatasync(fileno(file)) && ok;
+		ok = !fclose(file) && ok;
+		ok = ok && !rename(tmp, path);
+		if (!ok) unlink(tmp);
+	}
+
+	free(buf.data);
+	free(path);
+	free(tmp);
+}
+
+void
+session_update(void)
+{
+	if (!session_active) return;
+
+	if (current_ms() - session_saved >= SESSION_SAVE_MS)
+		session_save();
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+/* player and view state kept across runs in datadir/.session */
+void session_load(void);
+void session_save(void);
+void session_update(void);
@@ -14,6 +14,8 @@ style_init(void)
 	style_add(STYLE_ITEM_SEL, COLOR_YELLOW, COLOR_BLACK, A_BOLD);
 	style_add(STYLE_ITEM_HOVER, COLOR_WHITE, COLOR_BLUE, 0);
 	style_add(STYLE_ITEM_HOVER_SEL, COLOR_YELLOW, COLOR_BLUE, A_BOLD);
+	style_add(STYLE_ITEM_MARK, COLOR_GREEN, COLOR_BLACK, A_BOLD);
+	style_add(STYLE_ITEM_HOVER_MARK, COLOR_GREEN, COLOR_BLUE, A_BOLD);
 	style_add(STYLE_ERROR, COLOR_RED, COLOR_BLACK, 0);
 	style_add(STYLE_PREV, COLOR_WHITE, COLOR_BLACK, A_DIM);
 }
@@ -14,6 +14,8 @@ enum {
 	STYLE_ITEM_SEL,
 	STYLE_ITEM_HOVER,
 	STYLE_ITEM_HOVER_SEL,
+	STYLE_ITEM_MARK,
+	STYLE_ITEM_HOVER_MARK,
 	STYLE_PREV,
 	STYLE_ERROR,
 	STYLE_COUNT
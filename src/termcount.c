@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+
+#include "termcount.h"
+
+#include "util.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+static void *termcount_relay(void *arg);
+
+static int tc_master = -1;
+static int tc_out = -1;
+static FILE *tc_file;
+static pthread_t tc_thread;
+static _Atomic uint64_t tc_read;
+
+void *
+termcount_relay(void *arg)
+{
+	char buf[4096];
+	ssize_t n, off, w;
+
+	/* ends with EIO once the slave side is closed */
+	while ((n = read(tc_master, buf, sizeof(buf))) > 0) {
+		atomic_fetch_add(&tc_read, n);
+		if (tc_out < 0) continue;
+		for (off = 0; off < n; off += w) {
+			w = write(tc_out, buf + off, n - off);
+			if (w <= 0) break;
+		}
+	}
+
+	return NULL;
+}
+
+FILE *
+termcount_open(int out_fd, int rows, int cols)
+{
+	struct winsize ws = { 0 };
+	int slave;
+
+	ASSERT(tc_master < 0);
+
+	tc_master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (tc_master < 0) ERROR(SYSTEM, "posix_openpt");
+	if (grantpt(tc_master) || unlockpt(tc_master))
+		ERROR(SYSTEM, "grantpt");
+
+	slave = open(ptsname(tc_master), O_RDWR | O_NOCTTY);
+	if (slave < 0) ERROR(SYSTEM, "open pty");
+
+	/* take the size of the real terminal unless given */
+	if (!rows || !cols) {
+		if (ioctl(out_fd, TIOCGWINSZ, &ws) || !ws.ws_row) {
+			ws.ws_row = 24;
+			ws.ws_col = 80;
+		}
+	} else {
+		ws.ws_row = rows;
+		ws.ws_col = cols;
+	}
+	ioctl(slave, TIOCSWINSZ, &ws);
+
+	tc_out = out_fd;
+	atomic_store(&tc_read, 0);
+	if (pthread_create(&tc_thread, NULL, termcount_relay, NULL))
+		ERROR(SYSTEM, "pthread_create");
+
+	tc_file = fdopen(slave, "w");
+	if (!tc_file) ERROR(SYSTEM, "fdopen");
+
+	return tc_file;
+}
+
+void
+termcount_close(void)
+{
+	if (tc_master < 0) return;
+
+	fclose(tc_file);
+	pthread_join(tc_thread, NULL);
+	close(tc_master);
+	tc_master = -1;
+}
+
+uint64_t
+termcount_bytes(void)
+{
+	uint64_t before, after;
+	int pending;
+
+	/* written = relayed + still queued, retry if the
+	 * relay thread read in between */
+	do {
+		before = atomic_load(&tc_read);
+		if (ioctl(tc_master, FIONREAD, &pending))
+			pending = 0;
+		after = atomic_load(&tc_read);
+	} while (before != after);
+
+	return after + pending;
+}
+
+bool
+termcount_resize(int fd, int *rows, int *cols)
+{
+	struct winsize ws, cur;
+
+	/* the real terminal's SIGWINCH does not reach the pty */
+	if (ioctl(fd, TIOCGWINSZ, &ws) || !ws.ws_row)
+		return false;
+
+	if (ioctl(fileno(tc_file), TIOCGWINSZ, &cur))
+		return false;
+
+	if (ws.ws_row == cur.ws_row && ws.ws_col == cur.ws_col)
+		return false;
+
+	ioctl(fileno(tc_file), TIOCSWINSZ, &ws);
+	*rows = ws.ws_row;
+	*cols = ws.ws_col;
+
+	return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* pseudo-terminal between curses and the real output,
+ * counting every byte curses writes */
+FILE *termcount_open(int out_fd, int rows, int cols);
+void termcount_close(void);
+
+uint64_t termcount_bytes(void);
+bool termcount_resize(int fd, int *rows, int *cols);
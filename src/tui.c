@@ -7,21 +7,27 @@
 #include "cmd.h"
 #include "data.h"
 #include "history.h"
+#include "job.h"
 #include "pane.h"
 #include "player.h"
 #include "list.h"
+#include "ref.h"
 #include "listnav.h"
 #include "log.h"
+#include "meta.h"
 #include "style.h"
 #include "strbuf.h"
+#include "termcount.h"
 #include "util.h"
 
 #include <ncurses.h>
 
+#include <termios.h>
 #include <unistd.h>
 #include <errno.h>
 #include <ctype.h>
 #include <string.h>
+#include <time.h>
 
 #undef KEY_ENTER
 #define KEY_ENTER '\n'
@@ -30,6 +36,10 @@
 #define KEY_TAB '\t'
 #define KEY_CTRL(c) ((c) & ~0x60)
 
+/* redraw interval without input, for things like time */
+#define TUI_TICK_MS 100
+#define TUI_FPS_DEFAULT 60
+
 enum {
 	IMODE_EXECUTE,
 	IMODE_TRACK_PLAY,
@@ -39,6 +49,15 @@ enum {
 	IMODE_COUNT
 };
 
+/* optional track pane columns, see TMUS_COLUMNS */
+enum {
+	COL_DURATION,
+	COL_SIZE,
+	COL_MTIME,
+	COL_BITRATE,
+	COL_COUNT
+};
+
 typedef char *(*completion_gen)(const char *text, int fwd, int state);
 
 static void pane_title(struct pane *pane, bool highlight, const char *fmtstr, ...);
@@ -64,10 +83,17 @@ static bool nav_to_track_tag(struct track *target);
 static bool nav_to_track(struct track *target);
 static bool rename_current_track(void);
 static bool delete_current_track(void);
+static void mark_current_track(void);
+static void clear_marked_tracks(void);
 static void queue_current_track(void);
 static void unqueue_last_track(void);
 static bool track_vis_name_cmp(struct link *l1, struct link *l2);
 static void sort_visible_tracks(void);
+static void track_cols_init(void);
+static void track_cols_fmt(struct track *track, char *buf, size_t size);
+static void track_pane_want(void);
+static const char *stats_str(const struct track_stats *stats);
+static void track_pane_title(char *buf, size_t size);
 static bool track_pane_input(wint_t c);
 static void track_pane_vis(struct pane *pane, int sel);
 
@@ -78,6 +104,7 @@ static bool nav_to_track_by_name(const char *name);
 static bool nav_to_track_vis_by_name(const char *name);
 static bool seek_tag(const char *name);
 static bool cmd_pane_input(wint_t c);
+static bool cmd_pane_row_damaged(struct pane *pane, int row, const char *key);
 static void cmd_pane_vis(struct pane *pane, int sel);
 
 static void update_tracks_vis(void);
@@ -85,6 +112,15 @@ static void reindex_selected_tags(void);
 static void main_input(wint_t c);
 static void main_vis(void);
 
+static bool motion_input(wint_t c);
+static void motion_flush(void);
+static void tui_input(wint_t c);
+static void tui_input_drain(void);
+
+static void record_input(wint_t c);
+static bool replay_read(void);
+static void replay_drain(void);
+
 static void tui_curses_init(void);
 static void tui_resize(void);
 
@@ -96,6 +132,16 @@ static const char imode_prefix[IMODE_COUNT] = {
 	[IMODE_TAG_SELECT] = '?',
 };
 
+static const struct {
+	const char *name;
+	int width;
+} track_col_info[COL_COUNT] = {
+	[COL_DURATION] = { "duration", 5 },
+	[COL_SIZE] = { "size", 6 },
+	[COL_MTIME] = { "mtime", 10 },
+	[COL_BITRATE] = { "bitrate", 5 },
+};
+
 static const char player_state_chars[] = {
 	[PLAYER_STATE_PAUSED] = '|',
 	[PLAYER_STATE_PLAYING] = '>',
@@ -104,6 +150,35 @@ static const char player_state_chars[] = {
 
 static int scrw, scrh;
 static int quit;
+static bool main_dirty;
+
+/* minimum time between frames */
+static int frame_ms;
+static uint64_t frame_last;
+
+/* measurement mode, bytes sent to the terminal per frame */
+static bool term_stats;
+static uint64_t term_bytes;
+static struct termios term_saved;
+static bool term_raw;
+
+/* keys handled per frame, written to or read from TMUS_RECORD
+ * and TMUS_REPLAY as lines of '<ms> <frame> <key>' */
+static FILE *record_file;
+static uint64_t record_start;
+static unsigned long record_frame;
+static FILE *replay_file;
+static uint64_t replay_ms, replay_clock;
+static unsigned long replay_frame, replay_frames;
+static wint_t replay_key;
+static bool replay_pending;
+
+static int track_cols[COL_COUNT];
+static int track_col_count;
+
+/* coalesced cursor motion not yet applied */
+static struct listnav *motion_nav;
+static int motion_sel;
 
 static struct pane pane_left, pane_right, pane_bot;
 static struct pane *const panes[] = {
@@ -129,7 +204,9 @@ static completion_gen completion;
 struct pane *cmd_pane, *tag_pane, *track_pane;
 struct pane *pane_sel, *pane_after_cmd;
 
-struct list *tracks_vis;
+struct olist *tracks_vis;
+struct list tracks_marked;
+int tracks_marked_count;
 int track_show_playlist;
 struct listnav tag_nav;
 struct listnav track_nav;
@@ -182,6 +259,9 @@ confirm_popup(const char *prompt)
 
 	delwin(win);
 
+	/* popup leaves its contents on screen */
+	tui_damage(DAMAGE_ALL);
+
 	return c == 'y';
 }
 
@@ -223,7 +303,7 @@ track_vis_name_gen(const char *text, int fwd, int reset)
 
 	if (reset) {
 		prevname = NULL;
-		cur = tracks_vis->head.next;
+		cur = tracks_vis->list.head.next;
 		link = cur;
 	} else {
 		link = fwd ? cur->next : cur->prev;
@@ -303,14 +383,14 @@ tag_name_gen(const char *text, int fwd, int reset)
 	char *dup;
 
 	if (reset) {
-		cur = tags.head.next;
+		cur = tags.list.head.next;
 		link = cur;
 	} else {
 		link = fwd ? cur->next : cur->prev;
 	}
 
 	while (LIST_INNER(link)) {
-		tag = UPCAST(link, struct tag, link);
+		tag = UPCAST(link, struct tag, link.link);
 		if (strcasestr(tag->name, text)) {
 			cur = link;
 			dup = astrdup(tag->name);
@@ -329,9 +409,9 @@ rename_current_tag(void)
 	struct tag *tag;
 	char *cmd;
 
-	link = list_at(&tags, tag_nav.sel);
+	link = olist_at(&tags, tag_nav.sel);
 	if (!link) return false;
-	tag = UPCAST(link, struct tag, link);
+	tag = UPCAST(link, struct tag, link.link);
 
 	cmd = aprintf("rename %s", tag->name);
 	select_cmd_pane(IMODE_EXECUTE);
@@ -347,11 +427,11 @@ toggle_current_tag(void)
 	struct link *link;
 	struct tag *tag;
 
-	if (list_empty(&tags)) return false;
+	if (olist_empty(&tags)) return false;
 
-	link = list_at(&tags, tag_nav.sel);
+	link = olist_at(&tags, tag_nav.sel);
 	if (!link) return false;
-	tag = UPCAST(link, struct tag, link);
+	tag = UPCAST(link, struct tag, link.link);
 
 	/* toggle tag in tags_sel */
 	if (link_inuse(&tag->link_sel)) {
@@ -361,6 +441,7 @@ toggle_current_tag(void)
 	}
 
 	playlist_outdated = true;
+	tui_damage(DAMAGE_TAGS);
 
 	return true;
 }
@@ -382,22 +463,22 @@ seek_next_selected_tag(void)
 	if (list_empty(&tags_sel))
 		return;
 
-	if (list_empty(&tags))
+	if (olist_empty(&tags))
 		return;
 
-	link = list_at(&tags, tag_nav.sel);
+	link = olist_at(&tags, tag_nav.sel);
 	if (!link) return;
 
 	index = tag_nav.sel;
-	tag = UPCAST(link, struct tag, link);
+	tag = UPCAST(link, struct tag, link.link);
 	do {
 		index += 1;
-		link = tag->link.next;
+		link = tag->link.link.next;
 		if (!LIST_INNER(link)) {
-			link = list_at(&tags, 0);
+			link = olist_at(&tags, 0);
 			index = 0;
 		}
-		tag = UPCAST(link, struct tag, link);
+		tag = UPCAST(link, struct tag, link.link);
 	} while (!link_inuse(&tag->link_sel));
 
 	listnav_update_sel(&tag_nav, index);
@@ -412,12 +493,10 @@ delete_current_tag(void)
 	if (!confirm_popup("Delete tag?"))
 		return;
 
-	link = list_at(&tags, tag_nav.sel);
+	link = olist_at(&tags, tag_nav.sel);
 	if (!link) return;
-	tag = UPCAST(link, struct tag, link);
-	if (link_inuse(&tag->link_sel))
-		playlist_outdated = true;
-	tag_rm(tag, true);
+	tag = UPCAST(link, struct tag, link.link);
+	job_rm_tag(tag);
 }
 
 bool
@@ -425,8 +504,8 @@ tag_name_cmp(struct link *l1, struct link *l2)
 {
 	struct tag *t1, *t2;
 
-	t1 = LINK_UPCAST(l1, struct tag, link);
-	t2 = LINK_UPCAST(l2, struct tag, link);
+	t1 = LINK_UPCAST(l1, struct tag, link.link);
+	t2 = LINK_UPCAST(l2, struct tag, link.link);
 
 	return strcmp(t1->name, t2->name) <= 0;
 }
@@ -434,7 +513,8 @@ tag_name_cmp(struct link *l1, struct link *l2)
 void
 sort_visible_tags(void)
 {
-	list_sort(&tags, false, tag_name_cmp);
+	olist_sort(&tags, false, tag_name_cmp);
+	tui_damage(DAMAGE_TAGS);
 }
 
 bool
@@ -487,24 +567,46 @@ tag_pane_input(wint_t c)
 void
 tag_pane_vis(struct pane *pane, int sel)
 {
+	static int drawn_sel, drawn_wmin, drawn_focus;
+	char count[16];
 	struct tag *tag;
 	struct link *link;
-	int index, tagsel;
-
-	werase(pane->win);
-	pane_title(pane, sel, "Tags");
+	int index, tagsel, shift;
 
-	listnav_update_bounds(&tag_nav, 0, list_len(&tags));
+	listnav_update_bounds(&tag_nav, 0, olist_len(&tags));
 	listnav_update_wlen(&tag_nav, pane->h - 1);
 
-	index = -1;
-	for (LIST_ITER(&tags, link)) {
-		tag = UPCAST(link, struct tag, link);
+	/* focus change affects every row */
+	if (sel != drawn_focus)
+		pane->dirty = true;
+
+	/* keep rows that stay visible and only draw the new ones */
+	shift = tag_nav.wmin - drawn_wmin;
+	if (!pane->dirty && shift && ABS(shift) < pane->h - 1)
+		pane_scroll(pane, 1, shift);
+	else if (shift)
+		pane->dirty = true;
+
+	if (!pane->dirty && !shift && tag_nav.sel == drawn_sel)
+		return;
+
+	if (pane->dirty) {
+		werase(pane->win);
+		pane_title(pane, sel, "Tags");
+	}
+
+	link = olist_at(&tags, tag_nav.wmin);
+	for (index = tag_nav.wmin; index < tag_nav.wmax; index++) {
+		if (!LIST_INNER(link)) break;
+		tag = UPCAST(link, struct tag, link.link);
 		tagsel = link_inuse(&tag->link_sel);
+		link = link->next;
 
-		index += 1;
-		if (index < tag_nav.wmin) continue;
-		if (index >= tag_nav.wmax) break;
+		/* otherwise only the old and new selection changed */
+		if (!pane->dirty && index != tag_nav.sel && index != drawn_sel
+				&& index >= drawn_wmin
+				&& index < drawn_wmin + pane->h - 1)
+			continue;
 
 		if (sel && tagsel && index == tag_nav.sel)
 			style_on(pane->win, STYLE_ITEM_HOVER_SEL);
@@ -515,7 +617,9 @@ tag_pane_vis(struct pane *pane, int sel)
 		else if (index == tag_nav.sel)
 			style_on(pane->win, STYLE_PREV);
 
-		pane_writeln(pane, 1 + index - tag_nav.wmin, tag->name);
+		snprintf(count, sizeof(count), " %i", tag->stats.count);
+		pane_writeln_cols(pane, 1 + index - tag_nav.wmin,
+			&tag->disp, tag->name, count);
 
 		if (sel && tagsel && index == tag_nav.sel)
 			style_off(pane->win, STYLE_ITEM_HOVER_SEL);
@@ -526,6 +630,10 @@ tag_pane_vis(struct pane *pane, int sel)
 		else if (index == tag_nav.sel)
 			style_off(pane->win, STYLE_PREV);
 	}
+
+	drawn_sel = tag_nav.sel;
+	drawn_wmin = tag_nav.wmin;
+	drawn_focus = sel;
 }
 
 bool
@@ -534,7 +642,7 @@ play_current_track(void)
 	struct link *link;
 	struct track *track;
 
-	link = list_at(tracks_vis, track_nav.sel);
+	link = olist_at(tracks_vis, track_nav.sel);
 	if (!link) return false;
 	track = tracks_vis_track(link);
 	player_play_track(track, true);
@@ -549,7 +657,7 @@ nav_to_track_tag(struct track *target)
 
 	if (!target) return false;
 
-	index = list_index(&tags, &target->tag->link);
+	index = olist_index(&tags, &target->tag->link);
 	if (index < 0) return false;
 
 	listnav_update_sel(&tag_nav, index);
@@ -561,21 +669,17 @@ nav_to_track_tag(struct track *target)
 bool
 nav_to_track(struct track *target)
 {
-	struct link *link;
-	struct track *track;
 	int index;
 
 	if (!target) return false;
 
-	index = 0;
-	for (LIST_ITER(tracks_vis, link)) {
-		track = tracks_vis_track(link);
-		if (track == target) {
-			listnav_update_sel(&track_nav, index);
-			break;
-		}
-		index += 1;
-	}
+	if (tracks_vis == &player.playlist)
+		index = olist_index(tracks_vis, &target->link_pl);
+	else
+		index = olist_index(tracks_vis, &target->link_tt);
+
+	if (index >= 0)
+		listnav_update_sel(&track_nav, index);
 
 	return true;
 }
@@ -587,11 +691,15 @@ rename_current_track(void)
 	struct track *track;
 	char *cmd;
 
-	link = list_at(tracks_vis, track_nav.sel);
+	link = olist_at(tracks_vis, track_nav.sel);
 	if (!link) return false;
 	track = tracks_vis_track(link);
 
-	cmd = aprintf("rename %s", track->name);
+	/* marked tracks take an old/new replacement */
+	if (!list_empty(&tracks_marked))
+		cmd = aprintf("rename ");
+	else
+		cmd = aprintf("rename %s", track->name);
 	select_cmd_pane(IMODE_EXECUTE);
 	inputln_replace(history->input, cmd);
 	free(cmd);
@@ -602,38 +710,85 @@ rename_current_track(void)
 bool
 delete_current_track(void)
 {
+	struct job *trash, *delete;
+	struct list targets;
 	struct link *link;
 	struct track *track;
 
-	link = list_at(tracks_vis, track_nav.sel);
-	if (!link) return false;
-
-	track = tracks_vis_track(link);
+	list_init(&targets);
+	if (!tui_take_tracks(&targets))
+		return false;
 
-	if (!trash_tag || !strcmp(track->tag->name, "trash")) {
-		if (!track_rm(track, true))
-			USER_STATUS("Failed to remove track");
-	} else {
-		if (!track_move(track, trash_tag) && errno != EEXIST)
-			USER_STATUS("Failed to trash track: %s", strerror(errno));
-		if (errno == EEXIST && !track_rm(track, true))
-			USER_STATUS("Failed to remove track");
+	/* tracks already in the trash are deleted for good */
+	trash = job_create(JOB_TRASH, trash_tag);
+	delete = job_create(JOB_DELETE, NULL);
+	for (LIST_ITER(&targets, link)) {
+		track = UPCAST(link, struct ref, link)->data;
+		if (!trash_tag || track->tag == trash_tag)
+			job_add_track(delete, track);
+		else
+			job_add_track(trash, track);
 	}
+	job_submit(trash);
+	job_submit(delete);
+
+	refs_free(&targets);
 
 	return true;
 }
 
 void
-queue_current_track(void)
+mark_current_track(void)
 {
 	struct link *link;
 	struct track *track;
 
-	link = list_at(tracks_vis, track_nav.sel);
+	link = olist_at(tracks_vis, track_nav.sel);
 	if (!link) return;
 
 	track = tracks_vis_track(link);
-	list_push_back(&player.queue, &track->link_pq);
+	if (link_inuse(&track->link_mk)) {
+		link_pop(&track->link_mk);
+		tracks_marked_count -= 1;
+	} else {
+		list_push_back(&tracks_marked, &track->link_mk);
+		tracks_marked_count += 1;
+	}
+
+	tui_damage(DAMAGE_CMD);
+	listnav_update_sel(&track_nav, track_nav.sel + 1);
+
+	/* on the last row the selection stays, redraw the mark */
+	if (olist_at(tracks_vis, track_nav.sel) == link)
+		tui_damage(DAMAGE_TRACKS);
+}
+
+void
+clear_marked_tracks(void)
+{
+	while (!list_empty(&tracks_marked))
+		list_pop_front(&tracks_marked);
+	tracks_marked_count = 0;
+
+	tui_damage(DAMAGE_TRACKS | DAMAGE_CMD);
+}
+
+void
+queue_current_track(void)
+{
+	struct list targets;
+	struct link *link;
+	struct track *track;
+
+	list_init(&targets);
+	tui_take_tracks(&targets);
+
+	for (LIST_ITER(&targets, link)) {
+		track = UPCAST(link, struct ref, link)->data;
+		player_queue_push(track);
+	}
+
+	refs_free(&targets);
 }
 
 void
@@ -643,7 +798,7 @@ unqueue_last_track(void)
 
 	link = list_back(&player.queue);
 	if (!link) return;
-	link_pop(link);
+	player_queue_rm(UPCAST(link, struct track, link_pq));
 }
 
 bool
@@ -663,12 +818,13 @@ sort_visible_tracks(void)
 	struct link *link;
 	struct tag *tag;
 
-	list_sort(tracks_vis, false, track_vis_name_cmp);
+	olist_sort(tracks_vis, false, track_vis_name_cmp);
+	tui_damage(DAMAGE_TRACKS);
 
 	if (!track_show_playlist) {
-		link = list_at(&tags, tag_nav.sel);
+		link = olist_at(&tags, tag_nav.sel);
 		if (!link) return;
-		tag = LINK_UPCAST(link, struct tag, link);
+		tag = LINK_UPCAST(link, struct tag, link.link);
 		tag->reordered = true;
 	}
 }
@@ -715,6 +871,12 @@ track_pane_input(wint_t c)
 	case L'D': /* delete track */
 		delete_current_track();
 		break;
+	case L'v': /* toggle track mark */
+		mark_current_track();
+		break;
+	case L'V': /* clear track marks */
+		clear_marked_tracks();
+		break;
 	case KEY_CTRL(L's'): /* sort track in view */
 		sort_visible_tracks();
 		break;
@@ -726,56 +888,211 @@ track_pane_input(wint_t c)
 }
 
 void
-track_pane_vis(struct pane *pane, int sel)
+track_cols_init(void)
+{
+	const char *envstr, *tok;
+	size_t len;
+	int i;
+
+	envstr = getenv("TMUS_COLUMNS");
+	if (!envstr) envstr = "duration";
+
+	track_col_count = 0;
+	for (tok = envstr; *tok; tok += len + (tok[len] == ',')) {
+		len = strcspn(tok, ",");
+		for (i = 0; i < COL_COUNT; i++) {
+			if (strlen(track_col_info[i].name) == len
+					&& !strncmp(tok, track_col_info[i].name, len))
+				break;
+		}
+		if (i == COL_COUNT || track_col_count == COL_COUNT)
+			continue;
+		track_cols[track_col_count++] = i;
+	}
+}
+
+void
+track_cols_fmt(struct track *track, char *buf, size_t size)
+{
+	struct meta *meta;
+	char val[32];
+	struct tm tm;
+	size_t len;
+	int i, col;
+
+	/* blank until scanned, the name does not jump around */
+	meta = meta_get(track);
+	buf[0] = '\0';
+	for (len = i = 0; i < track_col_count && len < size; i++) {
+		col = track_cols[i];
+		val[0] = '\0';
+		if (!meta || !meta->ino) {
+			;
+		} else if (col == COL_DURATION && meta->duration) {
+			snprintf(val, sizeof(val), "%s",
+				timestr(meta->duration / 1000));
+		} else if (col == COL_SIZE) {
+			snprintf(val, sizeof(val), "%s", sizestr(meta->size));
+		} else if (col == COL_MTIME) {
+			localtime_r(&meta->mtime.tv_sec, &tm);
+			strftime(val, sizeof(val), "%Y-%m-%d", &tm);
+		} else if (col == COL_BITRATE && meta->duration) {
+			snprintf(val, sizeof(val), "%luk", (unsigned long)
+				(meta->size * 8 / meta->duration));
+		}
+		len += snprintf(buf + len, size - len, " %*s",
+			track_col_info[col].width, val);
+	}
+}
+
+void
+track_pane_want(void)
+{
+	struct link *link;
+	int index, end;
+
+	if (!track_col_count) return;
+
+	/* bottom up, the scanner takes the first visible row first */
+	end = MIN(track_nav.wmax + track_nav.wlen, olist_len(tracks_vis));
+	if (end <= track_nav.wmin) return;
+
+	link = olist_at(tracks_vis, end - 1);
+	for (index = end - 1; index >= track_nav.wmin; index--) {
+		meta_want(tracks_vis_track(link));
+		link = link->prev;
+	}
+}
+
+const char *
+stats_str(const struct track_stats *stats)
+{
+	static char buf[64];
+	const char *approx;
+	size_t len;
+
+	len = snprintf(buf, sizeof(buf), "%i tracks", stats->count);
+	if (!stats->scanned)
+		return buf;
+
+	/* sums over the scanned tracks are a lower bound */
+	approx = stats->scanned < stats->count ? "~" : "";
+	len += snprintf(buf + len, sizeof(buf) - len, ", %s%s",
+		approx, sizestr(stats->size));
+	snprintf(buf + len, sizeof(buf) - len, ", %s%s",
+		approx, timestr(stats->duration / 1000));
+
+	return buf;
+}
+
+void
+track_pane_title(char *buf, size_t size)
 {
-	struct track *track;
 	struct link *link;
 	struct tag *tag;
-	int index;
 
-	werase(pane->win);
 	if (tracks_vis == &player.playlist) {
-		pane_title(pane, sel, "Tracks (playlist)");
+		snprintf(buf, size, "Tracks (playlist) %s",
+			stats_str(&player.playlist_stats));
 	} else {
-		link = list_at(&tags, tag_nav.sel);
+		link = olist_at(&tags, tag_nav.sel);
 		if (!link) {
-			pane_title(pane, sel, "Tracks");
+			snprintf(buf, size, "Tracks");
 		} else {
-			tag = UPCAST(link, struct tag, link);
-			pane_title(pane, sel, "Tracks (%s)", tag->name);
+			tag = UPCAST(link, struct tag, link.link);
+			snprintf(buf, size, "Tracks (%s) %s",
+				tag->name, stats_str(&tag->stats));
 		}
 	}
+}
+
+void
+track_pane_vis(struct pane *pane, int sel)
+{
+	static struct track *drawn_track;
+	static struct olist *drawn_list;
+	static int drawn_sel, drawn_wmin, drawn_focus;
+	static char drawn_title[256];
+	char title[256];
+	char cols[64];
+	struct track *track;
+	struct link *link;
+	int index, shift, style;
+	bool hover, marked;
 
 	listnav_update_wlen(&track_nav, pane->h - 1);
 
-	index = -1;
-	for (LIST_ITER(tracks_vis, link)) {
-		track = tracks_vis_track(link);
+	/* switching lists or focus change affects every row */
+	if (tracks_vis != drawn_list || sel != drawn_focus)
+		pane->dirty = true;
+
+	/* keep rows that stay visible and only draw the new ones */
+	shift = track_nav.wmin - drawn_wmin;
+	if (!pane->dirty && shift && ABS(shift) < pane->h - 1)
+		pane_scroll(pane, 1, shift);
+	else if (shift)
+		pane->dirty = true;
+
+	/* columns for the rows shown and the next page */
+	if (pane->dirty || shift)
+		track_pane_want();
+
+	/* sums change while scanning, redraw just the title then */
+	track_pane_title(title, sizeof(title));
+	if (pane->dirty)
+		werase(pane->win);
+	if (pane->dirty || strcmp(title, drawn_title)) {
+		pane_title(pane, sel, "%s", title);
+		strcpy(drawn_title, title);
+	}
 
-		index += 1;
-		if (index < track_nav.wmin) continue;
-		if (index >= track_nav.wmax) break;
+	if (!pane->dirty && !shift && track_nav.sel == drawn_sel
+			&& player.track == drawn_track)
+		return;
 
-		if (sel && index == track_nav.sel && track == player.track)
-			style_on(pane->win, STYLE_ITEM_HOVER_SEL);
-		else if (sel && index == track_nav.sel)
-			style_on(pane->win, STYLE_ITEM_HOVER);
+	link = olist_at(tracks_vis, track_nav.wmin);
+	for (index = track_nav.wmin; index < track_nav.wmax; index++) {
+		if (!LIST_INNER(link)) break;
+		track = tracks_vis_track(link);
+		link = link->next;
+
+		/* otherwise only selected and playing rows changed */
+		if (!pane->dirty && index != track_nav.sel
+				&& index != drawn_sel && track != player.track
+				&& track != drawn_track && index >= drawn_wmin
+				&& index < drawn_wmin + pane->h - 1)
+			continue;
+
+		hover = sel && index == track_nav.sel;
+		marked = link_inuse(&track->link_mk);
+		if (hover && track == player.track)
+			style = STYLE_ITEM_HOVER_SEL;
+		else if (hover && marked)
+			style = STYLE_ITEM_HOVER_MARK;
+		else if (hover)
+			style = STYLE_ITEM_HOVER;
 		else if (track == player.track)
-			style_on(pane->win, STYLE_ITEM_SEL);
+			style = STYLE_ITEM_SEL;
+		else if (marked)
+			style = STYLE_ITEM_MARK;
 		else if (index == track_nav.sel)
-			style_on(pane->win, STYLE_PREV);
+			style = STYLE_PREV;
+		else
+			style = -1;
 
-		pane_writeln(pane, 1 + index - track_nav.wmin, track->name);
+		track_cols_fmt(track, cols, sizeof(cols));
 
-		if (sel && index == track_nav.sel && track == player.track)
-			style_off(pane->win, STYLE_ITEM_HOVER_SEL);
-		else if (sel && index == track_nav.sel)
-			style_off(pane->win, STYLE_ITEM_HOVER);
-		else if (track == player.track)
-			style_off(pane->win, STYLE_ITEM_SEL);
-		else if (index == track_nav.sel)
-			style_off(pane->win, STYLE_PREV);
+		if (style >= 0) style_on(pane->win, style);
+		pane_writeln_cols(pane, 1 + index - track_nav.wmin,
+			&track->disp, track->name, cols);
+		if (style >= 0) style_off(pane->win, style);
 	}
+
+	drawn_track = player.track;
+	drawn_list = tracks_vis;
+	drawn_sel = track_nav.sel;
+	drawn_wmin = track_nav.wmin;
+	drawn_focus = sel;
 }
 
 void
@@ -865,16 +1182,16 @@ nav_to_track_by_name(const char *query)
 	if (!qtrack) return false;
 	qtrack += 1;
 
-	for (LIST_ITER(&tags, link)) {
-		tag = UPCAST(link, struct tag, link);
+	for (LIST_ITER(&tags.list, link)) {
+		tag = UPCAST(link, struct tag, link.link);
 		if (!strncmp(tag->name, qtag, qtrack - qtag - 1))
 			break;
 	}
 	if (!LIST_INNER(link))
 		return false;
 
-	for (LIST_ITER(&tag->tracks, link)) {
-		track = UPCAST(link, struct track, link_tt);
+	for (LIST_ITER(&tag->tracks.list, link)) {
+		track = UPCAST(link, struct track, link_tt.link);
 		if (!strcmp(track->name, qtrack)) {
 			nav_to_track_tag(track);
 			nav_to_track(track);
@@ -892,7 +1209,7 @@ nav_to_track_vis_by_name(const char *query)
 	struct track *track;
 	struct link *link;
 
-	for (LIST_ITER(tracks_vis, link)) {
+	for (LIST_ITER(&tracks_vis->list, link)) {
 		track = tracks_vis_track(link);
 		if (!strcmp(track->name, query)) {
 			nav_to_track(track);
@@ -912,9 +1229,9 @@ seek_tag(const char *query)
 	int index;
 
 	index = -1;
-	for (LIST_ITER(&tags, link)) {
+	for (LIST_ITER(&tags.list, link)) {
 		index += 1;
-		tag = UPCAST(link, struct tag, link);
+		tag = UPCAST(link, struct tag, link.link);
 		if (!strcmp(tag->name, query)) {
 			listnav_update_sel(&tag_nav, index);
 			pane_after_cmd = tag_pane;
@@ -1020,34 +1337,75 @@ cmd_pane_input(wint_t c)
 	return true; /* grab everything */
 }
 
+bool
+cmd_pane_row_damaged(struct pane *pane, int row, const char *key)
+{
+	static struct strbuf drawn[3] = { 0 };
+
+	ASSERT(row >= 0 && row < ARRLEN(drawn));
+
+	/* compare against what the row currently shows */
+	if (!pane->dirty && drawn[row].buf && !strcmp(drawn[row].buf, key))
+		return false;
+
+	strbuf_clear(&drawn[row]);
+	strbuf_append(&drawn[row], "%s", key);
+
+	return true;
+}
+
 void
 cmd_pane_vis(struct pane *pane, int sel)
 {
 	static struct strbuf line = { 0 };
+	static struct strbuf key = { 0 };
+	char flags[] = "[    ]";
+	struct job_progress jobs;
 	struct inputln *cmd;
+	struct track *track;
 	struct link *link;
+	struct meta *meta;
 	int index, offset;
 
-	werase(pane->win);
-
-	/* track name */
-	style_on(pane->win, STYLE_TITLE);
-	pane_clearln(pane, 0);
+	/* track name, or its tags once scanned */
+	strbuf_clear(&line);
+	if (player.track && !player.track->meta)
+		meta_want(player.track);
+	meta = player.track ? meta_get(player.track) : NULL;
 	if (player.loaded) {
-		strbuf_clear(&line);
-		if (player.track)
+		if (meta && meta->title && meta->artist)
+			strbuf_append(&line, " %s - %s",
+				meta->artist, meta->title);
+		else if (meta && meta->title)
+			strbuf_append(&line, " %s", meta->title);
+		else if (player.track)
 			strbuf_append(&line, " %s", player.track->name);
 		else if (player.track_name)
 			strbuf_append(&line, " (*) %s", player.track_name);
 		else
 			strbuf_append(&line, " <UNKNOWN>");
+	}
+
+	/* every tag holding the file */
+	if (player.loaded && player.track) {
+		track = player.track;
+		do {
+			strbuf_append(&line, "%s%s", track == player.track
+				? " (" : ", ", track->tag->name);
+			track = track->ino_next;
+		} while (track != player.track);
+		strbuf_append(&line, ")");
+	}
+
+	if (cmd_pane_row_damaged(pane, 0, line.buf)) {
+		style_on(pane->win, STYLE_TITLE);
 		pane_writeln(pane, 0, line.buf);
+		style_off(pane->win, STYLE_TITLE);
 	}
-	style_off(pane->win, STYLE_TITLE);
 
+	strbuf_clear(&line);
 	if (player.loaded) {
 		/* status line */
-		strbuf_clear(&line);
 		strbuf_append(&line, "%c ", player_state_chars[player.state]);
 		strbuf_append(&line, "%s / ", timestr(player.time_pos));
 		strbuf_append(&line, "%s", timestr(player.time_end));
@@ -1055,44 +1413,65 @@ cmd_pane_vis(struct pane *pane, int sel)
 		if (player.volume >= 0)
 			strbuf_append(&line, " - vol: %u%%", player.volume);
 
+		if (player.latency_ms >= 0)
+			strbuf_append(&line, " - lat: %ims", player.latency_ms);
+
+		if (player.underruns > 0)
+			strbuf_append(&line, " - xruns: %i", player.underruns);
+
 		if (player.status)
 			strbuf_append(&line, " | [PLAYER] %s", player.status);
 
-		if (list_len(&player.queue) > 0)
-			strbuf_append(&line, " | [QUEUE] %i tracks",
-				list_len(&player.queue));
-
-		ATTR_ON(pane->win, A_REVERSE);
-		pane_writeln(pane, 1, line.buf);
-		ATTR_OFF(pane->win, A_REVERSE);
+		if (player.queue_stats.count > 0)
+			strbuf_append(&line, " | [QUEUE] %s",
+				stats_str(&player.queue_stats));
 	} else if (player.status) {
 		/* player message */
-		strbuf_clear(&line);
 		strbuf_append(&line, "[PLAYER] %s", player.status);
-		pane_writeln(pane, 1, line.buf);
 	}
 
-	/* status bits on right of status line */
-	if (player.loaded)
-		ATTR_ON(pane->win, A_REVERSE);
+	if (!list_empty(&tracks_marked))
+		strbuf_append(&line, "%s[MARKED] %i tracks",
+			*line.buf ? " | " : "", tracks_marked_count);
+
+	if (job_progress(&jobs)) {
+		strbuf_append(&line, "%s[JOBS] %i left",
+			*line.buf ? " | " : "", jobs.left);
+		if (jobs.size)
+			strbuf_append(&line, " %i%%",
+				(int) (jobs.done * 100 / jobs.size));
+		if (jobs.eta >= 0)
+			strbuf_append(&line, " ETA %s", timestr(jobs.eta));
+	}
 
-	mvwaddstr(pane->win, 1, pane->w - 6, "[    ]");
+	/* status bits on right of status line */
 	if (list_empty(&player.history))
-		mvwaddstr(pane->win, 1, pane->w - 5, "H");
+		flags[1] = 'H';
 	if (track_show_playlist)
-		mvwaddstr(pane->win, 1, pane->w - 4, "P");
+		flags[2] = 'P';
 	if (player.autoplay)
-		mvwaddstr(pane->win, 1, pane->w - 3, "A");
+		flags[3] = 'A';
 	if (player.shuffle)
-		mvwaddstr(pane->win, 1, pane->w - 2, "S");
+		flags[4] = 'S';
+
+	strbuf_clear(&key);
+	strbuf_append(&key, "%i%s%s", player.loaded, flags, line.buf);
+	if (cmd_pane_row_damaged(pane, 1, key.buf)) {
+		if (player.loaded)
+			ATTR_ON(pane->win, A_REVERSE);
+
+		pane_writeln(pane, 1, line.buf);
+		mvwaddstr(pane->win, 1, pane->w - 6, flags);
 
-	if (player.loaded)
-		ATTR_OFF(pane->win, A_REVERSE);
+		if (player.loaded)
+			ATTR_OFF(pane->win, A_REVERSE);
+	}
 
+	strbuf_clear(&line);
+	offset = -1;
+	cmd = NULL;
 	if (sel || cmd_show) {
 		/* cmd and search input */
-		strbuf_clear(&line);
-
 		free(user_status);
 		user_status = NULL;
 
@@ -1108,27 +1487,31 @@ cmd_pane_vis(struct pane *pane, int sel)
 		} else {
 			strbuf_append(&line, "%c", imode_prefix[cmd_input_mode]);
 		}
-		offset = strlen(line.buf);
+
+		/* show cursor in text */
+		if (sel) offset = strlen(line.buf) + cmd->cur;
 
 		strbuf_append(&line, "%s", cmd->buf);
+	} else if (user_status && user_status_uptime) {
+		user_status_uptime--;
+		strbuf_append(&line, " %s", user_status);
+	} else {
+		free(user_status);
+		user_status = NULL;
+	}
 
+	strbuf_clear(&key);
+	strbuf_append(&key, "%i %s", offset, line.buf);
+	if (cmd_pane_row_damaged(pane, 2, key.buf)) {
 		pane_writeln(pane, 2, line.buf);
 
-		if (sel) { /* show cursor in text */
+		if (offset >= 0) {
 			ATTR_ON(pane->win, A_REVERSE);
-			wmove(pane->win, 2, offset + cmd->cur);
+			wmove(pane->win, 2, offset);
 			waddch(pane->win, cmd->cur < cmd->len
 				? cmd->buf[cmd->cur] : L' ');
 			ATTR_OFF(pane->win, A_REVERSE);
 		}
-	} else if (user_status && user_status_uptime) {
-		user_status_uptime--;
-		strbuf_clear(&line);
-		strbuf_append(&line, " %s", user_status);
-		pane_writeln(pane, 2, line.buf);
-	} else {
-		free(user_status);
-		user_status = NULL;
 	}
 }
 
@@ -1141,13 +1524,13 @@ update_tracks_vis(void)
 	if (track_show_playlist) {
 		tracks_vis = &player.playlist;
 	} else {
-		link = list_at(&tags, tag_nav.sel);
+		link = olist_at(&tags, tag_nav.sel);
 		if (!link) return;
-		tag = UPCAST(link, struct tag, link);
+		tag = UPCAST(link, struct tag, link.link);
 		tracks_vis = &tag->tracks;
 	}
 
-	listnav_update_bounds(&track_nav, 0, list_len(tracks_vis));
+	listnav_update_bounds(&track_nav, 0, olist_len(tracks_vis));
 }
 
 void
@@ -1155,17 +1538,10 @@ reindex_selected_tags(void)
 {
 	struct link *link;
 	struct tag *tag;
-	struct track *track;
-	struct tag *playing_tag;
-	char *playing_name;
+	uint64_t playing_id;
 
-	playing_tag = NULL;
-	playing_name = NULL;
-
-	if (player.track) {
-		playing_tag = player.track->tag;
-		playing_name = astrdup(player.track->name);
-	}
+	/* reindexed tracks keep their ids */
+	playing_id = player.track ? player.track->id : 0;
 
 	if (track_show_playlist) {
 		for (LIST_ITER(&tags_sel, link)) {
@@ -1173,21 +1549,14 @@ reindex_selected_tags(void)
 			tag_reindex_tracks(tag);
 		}
 	} else {
-		link = list_at(&tags, tag_nav.sel);
+		link = olist_at(&tags, tag_nav.sel);
 		if (!link) return;
-		tag = UPCAST(link, struct tag, link);
+		tag = UPCAST(link, struct tag, link.link);
 		tag_reindex_tracks(tag);
 	}
 
-	if (playing_tag) {
-		for (LIST_ITER(&playing_tag->tracks, link)) {
-			track = UPCAST(link, struct track, link_tt);
-			if (!strcmp(track->name, playing_name)) {
-				player.track = track;
-				break;
-			}
-		}
-	}
+	if (playing_id)
+		player.track = track_find_id(playing_id);
 }
 
 void
@@ -1211,7 +1580,7 @@ main_input(wint_t c)
 		player_seek(player.time_pos + 10);
 		break;
 	case L'o':
-		list_clear(&player.queue);
+		player_queue_clear();
 		break;
 	case L'h':
 		list_clear(&player.history);
@@ -1270,9 +1639,11 @@ main_input(wint_t c)
 	case KEY_CTRL('l'):
 		clear();
 		refresh();
+		tui_damage(DAMAGE_ALL);
 		break;
 	case KEY_CTRL(L'r'):
 		reindex_selected_tags();
+		tui_damage(DAMAGE_TRACKS);
 		break;
 	case L'q':
 		quit = 1;
@@ -1308,10 +1679,201 @@ main_vis(void)
 	style_off(stdscr, STYLE_PANE_SEP);
 }
 
+bool
+motion_input(wint_t c)
+{
+	struct listnav *nav;
+	int delta;
+
+	if (pane_sel == tag_pane)
+		nav = &tag_nav;
+	else if (pane_sel == track_pane)
+		nav = &track_nav;
+	else
+		return false;
+
+	switch (c) {
+	case KEY_UP:
+		delta = -1;
+		break;
+	case KEY_DOWN:
+		delta = 1;
+		break;
+	case KEY_PPAGE:
+		delta = -nav->wlen / 2;
+		break;
+	case KEY_NPAGE:
+		delta = nav->wlen / 2;
+		break;
+	default:
+		return false;
+	}
+
+	if (motion_nav != nav) {
+		motion_flush();
+		motion_nav = nav;
+		motion_sel = nav->sel;
+	}
+
+	/* clamp each step like listnav would */
+	motion_sel = MAX(MIN(motion_sel + delta, nav->max - 1), nav->min);
+
+	return true;
+}
+
+void
+motion_flush(void)
+{
+	if (!motion_nav) return;
+
+	listnav_update_sel(motion_nav, motion_sel);
+	motion_nav = NULL;
+}
+
+void
+tui_input(wint_t c)
+{
+	bool handled;
+
+	/* queued cursor motion is applied as a single step */
+	if (motion_input(c))
+		return;
+
+	motion_flush();
+
+	if (c == KEY_RESIZE) {
+		tui_resize();
+	} else {
+		handled = 0;
+		if (pane_sel && pane_sel->active)
+			handled = pane_sel->handle(c);
+
+		/* fallback if char not handled by pane */
+		if (!handled) main_input(c);
+	}
+}
+
+void
+tui_input_drain(void)
+{
+	uint64_t now;
+	wint_t c;
+
+	/* wait for the first key or the tick */
+	timeout(TUI_TICK_MS);
+	if (get_wch(&c) == ERR)
+		return;
+
+	/* apply everything queued, and what arrives before
+	 * the next frame is due, before rendering once */
+	record_frame += 1;
+	do {
+		record_input(c);
+		tui_input(c);
+		if (quit) break;
+
+		now = current_ms();
+		if (now >= frame_last + frame_ms)
+			timeout(0);
+		else
+			timeout(frame_last + frame_ms - now);
+	} while (get_wch(&c) != ERR);
+
+	motion_flush();
+}
+
+void
+record_input(wint_t c)
+{
+	if (!record_file) return;
+
+	fprintf(record_file, "%lu %lu %u\n", current_ms() - record_start,
+		record_frame, (unsigned int) c);
+}
+
+bool
+replay_read(void)
+{
+	unsigned int key;
+
+	replay_pending = fscanf(replay_file, "%lu %lu %u",
+		&replay_ms, &replay_frame, &key) == 3;
+	replay_key = key;
+
+	return replay_pending;
+}
+
+void
+replay_drain(void)
+{
+	unsigned long frame;
+
+	if (!replay_pending) {
+		quit = 1;
+		return;
+	}
+
+	/* idle time between frames passes on the sim clock */
+	if (replay_ms > replay_clock) {
+#ifdef PLAYER_SIM
+		/* a recorded :backend switch leaves the sim behind */
+		if (player.backend == &player_backend_sim)
+			player_sim_advance(replay_ms - replay_clock);
+#endif
+		replay_clock = replay_ms;
+	}
+
+	/* keys of one recorded frame are coalesced as before */
+	frame = replay_frame;
+	do {
+		tui_input(replay_key);
+		if (quit) break;
+	} while (replay_read() && replay_frame == frame);
+
+	motion_flush();
+	replay_frames += 1;
+}
+
 void
 tui_curses_init(void)
 {
-	initscr();
+	struct termios mode;
+	const char *envstr;
+	int rows, cols;
+
+	envstr = getenv("TMUS_REPLAY");
+	if (envstr) {
+		replay_file = fopen(envstr, "r");
+		if (!replay_file) ERROR(SYSTEM, "fopen %s", envstr);
+		if (fscanf(replay_file, "tmus %i %i", &rows, &cols) != 2)
+			ERRORX(USER, "Invalid recording %s", envstr);
+		replay_clock = 0;
+		replay_frames = 0;
+		replay_read();
+	}
+
+	term_stats = getenv("TMUS_TERM_STATS") != NULL || replay_file;
+	term_raw = false;
+	if (replay_file) {
+		/* headless, at the size of the recorded terminal */
+		if (!newterm(NULL, termcount_open(-1, rows, cols), stdin))
+			ERRORX(SYSTEM, "newterm");
+		term_bytes = 0;
+	} else if (term_stats) {
+		/* curses sets tty modes on its output, which is now
+		 * the pty, so put the real input into raw mode here */
+		if (!newterm(NULL, termcount_open(STDOUT_FILENO, 0, 0), stdin))
+			ERRORX(SYSTEM, "newterm");
+		if (isatty(STDIN_FILENO) && !tcgetattr(STDIN_FILENO, &term_saved)) {
+			mode = term_saved;
+			cfmakeraw(&mode);
+			tcsetattr(STDIN_FILENO, TCSANOW, &mode);
+			term_raw = true;
+		}
+		term_bytes = 0;
+	} else {
+		initscr();
+	}
 
 	/* do most of the handling ourselves,
 	 * enable special keys */
@@ -1321,7 +1883,7 @@ tui_curses_init(void)
 
 	/* update screen occasionally for things like
 	 * time even when no input was received */
-	halfdelay(1);
+	timeout(TUI_TICK_MS);
 
 	/* inits COLOR and COLOR_PAIRS used by styles */
 	start_color();
@@ -1332,6 +1894,16 @@ tui_curses_init(void)
 	/* we use ESC deselecting the current pane
 	 * and not for escape sequences, so dont wait */
 	ESCDELAY = 0;
+
+	envstr = getenv("TMUS_RECORD");
+	if (envstr && !replay_file) {
+		record_file = fopen(envstr, "w+");
+		if (!record_file) ERROR(SYSTEM, "fopen %s", envstr);
+		setvbuf(record_file, NULL, _IOLBF, 0);
+		fprintf(record_file, "tmus %i %i\n", LINES, COLS);
+		record_start = current_ms();
+		record_frame = 0;
+	}
 }
 
 void
@@ -1339,7 +1911,7 @@ tui_resize(void)
 {
 	struct link *link;
 	struct tag *tag;
-	int leftw;
+	int leftw, countw;
 
 	getmaxyx(stdscr, scrh, scrw);
 
@@ -1351,23 +1923,83 @@ tui_resize(void)
 		getmaxyx(stdscr, scrh, scrw);
 	}
 
-	/* adjust tag pane width to name lengths */
-	leftw = 0;
-	for (LIST_ITER(&tags, link)) {
-		tag = UPCAST(link, struct tag, link);
-		leftw = MAX(leftw, strlen(tag->name));
+	/* adjust tag pane width to name lengths and counts */
+	leftw = countw = 0;
+	for (LIST_ITER(&tags.list, link)) {
+		tag = UPCAST(link, struct tag, link.link);
+		leftw = MAX(leftw, dispstr_width(&tag->disp, tag->name));
+		countw = MAX(countw, snprintf(NULL, 0, " %i",
+			tag->stats.count));
 	}
-	leftw = MAX(leftw + 1, 0.2f * scrw);
+	leftw = MAX(leftw + countw + 1, 0.2f * scrw);
 
 	pane_resize(&pane_left, 0, 0, leftw, scrh - 3);
 	pane_resize(&pane_right, pane_left.ex + 1, 0, scrw, scrh - 3);
 	pane_resize(&pane_bot, 0, scrh - 3, scrw, scrh);
+
+	main_dirty = true;
+}
+
+int
+tui_take_tracks(struct list *refs)
+{
+	struct link *link;
+	struct track *track;
+	struct ref *ref;
+	int count;
+
+	/* marked tracks, else the one under the cursor */
+	count = 0;
+	while (!list_empty(&tracks_marked)) {
+		link = list_pop_front(&tracks_marked);
+		track = UPCAST(link, struct track, link_mk);
+		ref = ref_alloc(track);
+		list_push_back(refs, &ref->link);
+		count += 1;
+	}
+	tracks_marked_count = 0;
+
+	if (count) {
+		tui_damage(DAMAGE_TRACKS | DAMAGE_CMD);
+		return count;
+	}
+
+	link = olist_at(tracks_vis, track_nav.sel);
+	if (!link) return 0;
+
+	ref = ref_alloc(tracks_vis_track(link));
+	list_push_back(refs, &ref->link);
+
+	return 1;
+}
+
+void
+tui_damage(int what)
+{
+	if (what & DAMAGE_TAGS)
+		pane_left.dirty = true;
+	if (what & DAMAGE_TRACKS)
+		pane_right.dirty = true;
+	if (what & DAMAGE_CMD)
+		pane_bot.dirty = true;
+	if (what & DAMAGE_MAIN)
+		main_dirty = true;
 }
 
 void
 tui_init(void)
 {
+	const char *envstr;
+	int fps;
+
 	quit = 0;
+
+	envstr = getenv("TMUS_MAX_FPS");
+	fps = envstr ? atoi(envstr) : TUI_FPS_DEFAULT;
+	frame_ms = fps > 0 ? 1000 / fps : 0;
+	frame_last = 0;
+
+	motion_nav = NULL;
 	cmd_input_mode = IMODE_TRACK_SELECT;
 
 	user_status = NULL;
@@ -1383,6 +2015,8 @@ tui_init(void)
 	history_init(&command_history);
 	history = &command_history;
 
+	track_cols_init();
+
 	tui_curses_init();
 
 	style_init();
@@ -1400,12 +2034,16 @@ tui_init(void)
 	track_show_playlist = 0;
 	update_tracks_vis();
 
+	list_init(&tracks_marked);
+	tracks_marked_count = 0;
+
 	tui_resize();
 }
 
 void
 tui_deinit(void)
 {
+#ifdef LEAKCHECK
 	free(user_status);
 
 	inputln_deinit(&completion_query);
@@ -1419,44 +2057,77 @@ tui_deinit(void)
 	history_deinit(&track_vis_select_history);
 	history_deinit(&tag_select_history);
 	history_deinit(&command_history);
+#endif
 
 	if (!isendwin()) endwin();
+
+	if (term_stats) {
+		termcount_close();
+		if (term_raw)
+			tcsetattr(STDIN_FILENO, TCSANOW, &term_saved);
+	}
+
+	if (record_file) {
+		fclose(record_file);
+		record_file = NULL;
+	}
+
+	if (replay_file) {
+		log_info("REPLAY: %lu frames, %lu ms simulated\n",
+			replay_frames, replay_clock);
+		fclose(replay_file);
+		replay_file = NULL;
+	}
 }
 
 bool
 tui_update(void)
 {
-	bool handled;
-	wint_t c;
-	int i;
+	uint64_t bytes;
+	int i, rows, cols;
 
-	get_wch(&c);
-
-	if (c == KEY_RESIZE) {
+	/* resizes of the real terminal must be forwarded */
+	if (term_stats && !replay_file
+			&& termcount_resize(STDOUT_FILENO, &rows, &cols)) {
+		resize_term(rows, cols);
 		tui_resize();
-	} else if (c != ERR) {
-		handled = 0;
-		if (pane_sel && pane_sel->active)
-			handled = pane_sel->handle(c);
-
-		/* fallback if char not handled by pane */
-		if (!handled) main_input(c);
 	}
 
+	if (replay_file)
+		replay_drain();
+	else
+		tui_input_drain();
+
 	playlist_update();
 	update_tracks_vis();
 
-	refresh();
+	/* stdscr lies below the panes, draw it first */
+	if (main_dirty) {
+		main_vis();
+		wnoutrefresh(stdscr);
+		tui_damage(DAMAGE_TAGS | DAMAGE_TRACKS | DAMAGE_CMD);
+		main_dirty = false;
+	}
+
+	/* panes only redraw rows whose state changed */
 	for (i = 0; i < ARRLEN(panes); i++) {
 		/* only update ui for panes that are visible */
 		if (!panes[i]->active) continue;
 
 		panes[i]->update(panes[i], pane_sel == panes[i]);
+		panes[i]->dirty = false;
 		wnoutrefresh(panes[i]->win);
 	}
 
-	main_vis();
 	doupdate();
+	frame_last = current_ms();
+
+	if (term_stats) {
+		bytes = termcount_bytes();
+		if (bytes != term_bytes)
+			log_info("TUI: frame %lu bytes\n", bytes - term_bytes);
+		term_bytes = bytes;
+	}
 
 	return !quit;
 }
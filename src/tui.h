@@ -12,14 +12,28 @@
 		user_status_uptime = 10; \
 	} while (0)
 
+/* parts of the screen to redraw fully on next update */
+enum {
+	DAMAGE_TAGS = 1 << 0,
+	DAMAGE_TRACKS = 1 << 1,
+	DAMAGE_CMD = 1 << 2,
+	DAMAGE_MAIN = 1 << 3,
+	DAMAGE_ALL = DAMAGE_TAGS | DAMAGE_TRACKS | DAMAGE_CMD | DAMAGE_MAIN
+};
+
 void tui_init(void);
 void tui_deinit(void);
 bool tui_update(void);
+void tui_damage(int what);
+
+int tui_take_tracks(struct list *refs);
 
 extern struct pane *cmd_pane, *tag_pane, *track_pane;
 extern struct pane *pane_sel, *pane_after_cmd;
 
-extern struct list *tracks_vis;
+extern struct olist *tracks_vis;
+extern struct list tracks_marked; /* struct track (link_mk) */
+extern int tracks_marked_count;
 extern int track_show_playlist;
 
 extern struct listnav tag_nav;
@@ -189,6 +189,22 @@ timestr(unsigned int secs)
 	return buf;
 }
 
+const char *
+sizestr(uint64_t bytes)
+{
+	static char buf[16];
+
+	if (bytes < (1 << 20))
+		snprintf(buf, sizeof(buf), "%luK",
+			(unsigned long) (bytes + 1023) >> 10);
+	else if (bytes < (1 << 30))
+		snprintf(buf, sizeof(buf), "%.1fM", bytes / (double) (1 << 20));
+	else
+		snprintf(buf, sizeof(buf), "%.1fG", bytes / (double) (1 << 30));
+
+	return buf;
+}
+
 uint64_t
 current_ms(void)
 {
@@ -200,3 +216,14 @@ current_ms(void)
 
 	return ms;
 }
+
+uint64_t
+current_us(void)
+{
+	struct timespec tp;
+
+	/* monotonic, only for measuring intervals */
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+
+	return tp.tv_sec * 1000000UL + tp.tv_nsec / 1000UL;
+}
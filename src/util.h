@@ -6,6 +6,7 @@
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
+#define ABS(a) ((a) > 0 ? (a) : -(a))
 #define ARRLEN(x) (sizeof(x)/sizeof((x)[0]))
 
 #define PANIC(...) panic(__FILE__, __LINE__, "" __VA_ARGS__)
@@ -35,5 +36,7 @@ char *appendstrf(char *alloc, const char *fmtstr, ...);
 char *sanitized(const char *instr);
 
 const char *timestr(unsigned int seconds);
+const char *sizestr(uint64_t bytes);
 
 uint64_t current_ms(void);
+uint64_t current_us(void);